@@ -1,5 +1,11 @@
 #pragma once
 #include <cstdint>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <__msvc_int128.hpp> //MSVC has no __int128. this is the type its standard library uses for iota_view, and it has all the arithmetic operators
+using int128 = std::_Signed128;
+#else
+using int128 = __int128;
+#endif
 
 //future: https://stackoverflow.com/a/30824434 is probably better.
 
@@ -34,6 +40,13 @@ unsigned div_floor(unsigned a, unsigned b) {
 	return a / b;
 };
 
+//division rounding to negative infinity, for types without an overload above, like int128. can handle negative first value, but not negative second value
+template <typename T>
+T div_floor(T a, T b) {
+	if (a < 0) return T(-1) - (T(-1) - a) / b;
+	return a / b;
+}
+
 inline uint64_t positive_modulo(int64_t a, uint64_t b) {
 	return a - div_floor(a, b) * b;
 }
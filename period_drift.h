@@ -0,0 +1,82 @@
+#pragma once
+#include "timing.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+//the estimators tolerate clock skew, but they never said how much there was. a display clock that's warming up makes the period creep, and the tearline with it.
+//each estimate's period is the average over its window, so it belongs to the middle of the window. (time of the middle, period) is one sample of the period over time.
+//the drift is the slope of an exponentially weighted linear regression through those samples. it's O(1) per sample, and doesn't need the window.
+//successive samples share most of their window, so they're correlated. that doesn't bias the slope, it only makes it noisier, which the long half-life smooths out.
+struct period_drift_filter {
+	bool enabled = true;
+	double half_life = 4096; //samples. at 60 Hz, about a minute, which is the timescale of a display warming up
+	double min_span = 10; //seconds. the slope isn't published until the samples cover this much time. over a few window spans, it's mostly noise
+	double max_jump = 0.002; //a sample this far from the mean period (relative) is a mode change, not drift. the filter starts over
+	//a smaller mode change, like 59.94 Hz to 60 Hz, is under max_jump. the regression took the step for a minute of drift, and bent vf's phase 20-80 us early for that long.
+	//	so a sample far from the trend, by the samples' own scatter, is a mode change too. the scatter is the feeder's: the relative distance from the trend was at most 3e-6 for a 256-point finder, 7e-6 for the PLL, and 4e-4 for a 16-point finder
+	double jump_deviations = 16; //standard deviations of the scatter
+	double min_jump = 3e-5; //relative. a long window's samples share most of their points, so their scatter around the trend is 1e-8, and any small step would look like a mode change. 59.94 Hz to 59.95 Hz is 1.7e-4
+	uint settle_samples = 64; //before this many samples, the trend is too rough to measure a scatter against
+	double scatter = 0; //relative^2. the mean square distance of the samples from the trend. it's the feeder's, so it's kept through resets
+	double scatter_rate = 1.0 / 256;
+	double scatter_cap = 4; //standard deviations. what one sample can teach the scatter. after a mode change, the window mixes old and new points, and the period ramps over a window instead of jumping. uncapped, the scatter learned the ramp faster than it grew
+	uint samples = 0; //since the last reset
+
+	double weight = 0; //sum of the decayed weights
+	double mean_time = 0; //seconds, relative to origin
+	double mean_period = 0; //ticks
+	double time_moment = 0; //weighted sum of (time - mean_time)^2
+	double co_moment = 0; //weighted sum of (time - mean_time) * (period - mean_period)
+	uint64_t origin = 0; //ticks. the first sample's time. times are stored relative to it, so the doubles keep their precision
+
+	void reset() {
+		weight = mean_time = mean_period = time_moment = co_moment = 0;
+		samples = 0;
+	}
+
+	//relative. how far period is from the regression line at time. 0 until the line has settle_samples
+	double distance_from_trend(uint64_t time, double period) {
+		if (samples < settle_samples || time_moment <= 0)
+			return 0;
+		double t = double(int64_t(time - origin)) / ticks_per_sec;
+		return (period - (mean_period + co_moment / time_moment * (t - mean_time))) / mean_period;
+	}
+
+	//time: ticks, where the period was measured. period: ticks
+	void add(uint64_t time, double period) {
+		if (!enabled || period <= 0)
+			return;
+		double distance = distance_from_trend(time, period);
+		if (weight > 0 && std::abs(period - mean_period) > max_jump * mean_period)
+			reset();
+		else if (scatter > 0 && std::abs(distance) > std::max(min_jump, jump_deviations * std::sqrt(scatter)))
+			reset();
+		else if (samples >= settle_samples)
+			scatter = scatter == 0 ? distance * distance : scatter + (std::min(distance * distance, scatter_cap * scatter_cap * scatter) - scatter) * scatter_rate;
+		if (weight == 0)
+			origin = time;
+		double t = double(int64_t(time - origin)) / ticks_per_sec;
+		++samples;
+		//West's weighted update. decaying the old weights scales the moments and leaves the means alone
+		double decay = std::exp2(-1 / half_life);
+		weight = weight * decay + 1;
+		time_moment *= decay;
+		co_moment *= decay;
+		double time_difference = t - mean_time;
+		mean_time += time_difference / weight;
+		mean_period += (period - mean_period) / weight;
+		time_moment += time_difference * (t - mean_time);
+		co_moment += time_difference * (period - mean_period);
+	}
+
+	//how much time the samples cover, in seconds. for evenly spaced samples with equal weight, it's their span
+	double span() { return weight > 0 ? std::sqrt(12 * time_moment / weight) : 0; }
+
+	//ppm per second: how fast the period changes, relative to itself. positive = the period is getting longer. 0 until the samples cover min_span
+	double drift() {
+		if (!enabled || span() < min_span || mean_period <= 0)
+			return 0;
+		return co_moment / time_moment / mean_period * 1e6;
+	}
+};
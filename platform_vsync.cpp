@@ -20,3 +20,4 @@ int total_scanlines; //such as 1125
 int active_scanlines; //such as 1080
 int porch_scanlines; //porch = 1125 - 1080
 int scanlines_between_sync_and_first_displayed_line = 1; //VBI + back porch. it's at least 1.
+double modeline_Hz = 0; //refresh rate from the modeline, with its fractional part (such as 59.94). 0 if unknown
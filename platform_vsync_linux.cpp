@@ -6,20 +6,15 @@
 #include "glfw include.h"
 #include "X11/extensions/Xrandr.h" //to get modeline information
 #include "platform_vsync.h"
+#include "vblank_source.cpp"
 
 #define GLX_GLXEXT_PROTOTYPES //for glXGetSyncValuesOML
 #include "GL/glx.h"
 
 #define ANY_SYNC_SUPPORTED 1
-#define SYNC_IN_RENDER_THREAD 1
-#define SYNC_IN_SEPARATE_THREAD 0
-#define SYNC_LINUX 1
 
 GLXDrawable global_drawable;
 Display* global_display;
-int64_t ust_global; //timestamp
-int64_t msc_global; //vertical retrace number
-int64_t sbc_global; //swap buffer number
 
 //run this after making the OpenGL context current
 void prepare_sync() {
@@ -32,34 +27,32 @@ void prepare_sync() {
 	//see https://invent.kde.org/plasma/kwin/-/blob/master/src/backends/x11/standalone/x11_standalone_omlsynccontrolvsyncmonitor.cpp
 	//check(glfwExtensionSupported("GLX_OML_sync_control"), "OML not supported"); //this is not the right way to check for the extension
 }
-namespace vscan {
-extern uint64_t phase;
-extern double period;
-}
-
-void get_sync_values() {
-	auto old_ust = ust_global;
-	auto old_msc = msc_global;
-	bool result = glXGetSyncValuesOML(global_display, global_drawable, &ust_global, &msc_global, &sbc_global);
+//the counter's reads go to whoever subscribed, see counter_to_estimate() in the demo
+bool read_oml_counter(vblank_counter_read& read) {
+	int64_t ust; //timestamp
+	int64_t msc; //vertical retrace number
+	int64_t sbc; //swap buffer number
+	bool result = glXGetSyncValuesOML(global_display, global_drawable, &ust, &msc, &sbc);
 	check(result == 1, "OML failed");
-	if (msc_global != old_msc) {
-		vscan::phase = ust_global * 1000 + 500; //UST is in microseconds, the system clock is in nanoseconds. so we apply a very stupid transform here. this will fail if the main clock wraps around, but that takes 600 years, so I'm not worried
-		vscan::period = (ust_global - old_ust) * 1000.0 / (msc_global - old_msc); //period is in nanoseconds
-	}
+	read.timestamp = ust * 1000 + 500; //UST is in microseconds, the system clock is in nanoseconds. so we apply a very stupid transform here. this will fail if the main clock wraps around, but that takes 600 years, so I'm not worried
+	read.count = msc;
 	//good news: UST is benched to Linux's steady clock, not the realtime clock
-	//outc("realtime, steady", std::chrono::high_resolution_clock::now().time_since_epoch().count(), now(), vscan::phase);
-	//outc("UST was", ust_global, msc_global, sbc_global, now());
+	//outc("realtime, steady", std::chrono::high_resolution_clock::now().time_since_epoch().count(), now(), read.timestamp);
+	//outc("UST was", ust, msc, sbc, now());
+	return true;
 }
 
-//call this after prepare_sync(); it uses the global_display
-//this acquires modeline information
+bool oml_registered = register_vblank_source({.name = "oml", .capabilities = capability_counter, .prepare = prepare_sync, .read_counter = read_oml_counter});
+
+//this acquires modeline information. it only needs the window, not the GL context, so it can run before the vsync thread starts
 //how to map xrandr values to porch info: https://www.reddit.com/r/SolusProject/comments/hp96vl/mapping_for_xrandr_modeline_and_windows_porchsync/
 //https://www.mythtv.org/wiki/Working_with_Modelines#Working_with_Modelines_by_Hand
 void get_scanline_info() {
+	Display* display = glfwGetX11Display();
 	auto X11window = glfwGetX11Window(window);
-	XRRScreenResources* sr = XRRGetScreenResourcesCurrent(global_display, X11window);
+	XRRScreenResources* sr = XRRGetScreenResourcesCurrent(display, X11window);
 	RRCrtc current_crtc = glfwGetX11Adapter(active_monitor);
-	XRRCrtcInfo* ci = XRRGetCrtcInfo(global_display, sr, current_crtc);
+	XRRCrtcInfo* ci = XRRGetCrtcInfo(display, sr, current_crtc);
 
 	for (unsigned mode_number : zero_to(sr->nmode)) {
 		XRRModeInfo& mode = sr->modes[mode_number];
@@ -72,7 +65,13 @@ void get_scanline_info() {
 			unsigned VBI = mode.vSyncEnd - mode.vSyncStart;
 			unsigned back_porch = mode.vTotal - mode.vSyncEnd;
 			scanlines_between_sync_and_first_displayed_line = VBI + back_porch;
-			outc("vertical height", active_scanlines, "vertical total", total_scanlines, "front porch", front_porch, "VBI", VBI, "back porch", back_porch);
+			//the pixel clock runs through every pixel of the total frame, including the porches. this is the same calculation xrandr does
+			modeline_Hz = double(mode.dotClock) / (double(mode.hTotal) * mode.vTotal);
+			if (mode.modeFlags & RR_DoubleScan)
+				modeline_Hz /= 2;
+			if (mode.modeFlags & RR_Interlace)
+				modeline_Hz *= 2;
+			outc("vertical height", active_scanlines, "vertical total", total_scanlines, "front porch", front_porch, "VBI", VBI, "back porch", back_porch, "refresh", modeline_Hz, "Hz");
 		}
 	}
 	XRRFreeCrtcInfo (ci);
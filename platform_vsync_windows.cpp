@@ -3,14 +3,12 @@
 #include "console.h"
 #include "renderer.h"
 #include "platform_vsync.h"
+#include "vblank_source.cpp"
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 #define ANY_SYNC_SUPPORTED 1
-#define SYNC_IN_RENDER_THREAD 1
-#define SCANLINE_VSYNC 1
-#define SYNC_IN_SEPARATE_THREAD 0
-//make sure at most one of SYNC_IN_SEPARATE_THREAD and SYNC_IN_RENDER_THREAD is true. not both!
-//if you want to use the vblank waiting system (WaitForVerticalBlank) instead of the scanline system, then change: SYNC_IN_SEPARATE_THREAD 1, SYNC_IN_RENDER_THREAD 0, and in render.h, sync_mode = separate_heartbeat
+//the source below can both wait for the vblank and read the scanline. sync_mode in renderer.h picks which one is used:
+//if you want to use the vblank waiting system (WaitForVerticalBlank) instead of the scanline system, then change sync_mode = separate_heartbeat in renderer.h
 
 //credits:
 //EnumDisplayDevices code plagiarized from https://stackoverflow.com/questions/9524309/enumdisplaydevices-function-not-working-for-me
@@ -65,15 +63,12 @@ bool vertical_sync_acquire = []() {
 		DeleteDC(hdc);
 		error("failed to open adapter from hDc");
 	}
-	if (render::sync_mode == render::separate_heartbeat) {
-		VBlankHandle.hAdapter = OpenAdapterData.hAdapter;
-		VBlankHandle.hDevice = 0; //optional. maybe OpenDeviceHandle will give it to us, https://docs.microsoft.com/en-us/windows/desktop/api/dxva2api/nf-dxva2api-idirect3ddevicemanager9-opendevicehandle
-		VBlankHandle.VidPnSourceId = OpenAdapterData.VidPnSourceId;
-	}
-	else if (render::sync_mode == render::sync_in_render_thread) {
-		scanline_windows.hAdapter = OpenAdapterData.hAdapter;
-		scanline_windows.VidPnSourceId = OpenAdapterData.VidPnSourceId;
-	}
+	//both, whatever sync_mode is, since fuse_vblank_sources waits for the vblank and reads the scanline at once
+	VBlankHandle.hAdapter = OpenAdapterData.hAdapter;
+	VBlankHandle.hDevice = 0; //optional. maybe OpenDeviceHandle will give it to us, https://docs.microsoft.com/en-us/windows/desktop/api/dxva2api/nf-dxva2api-idirect3ddevicemanager9-opendevicehandle
+	VBlankHandle.VidPnSourceId = OpenAdapterData.VidPnSourceId;
+	scanline_windows.hAdapter = OpenAdapterData.hAdapter;
+	scanline_windows.VidPnSourceId = OpenAdapterData.VidPnSourceId;
 	return 0;
 }();
 
@@ -139,23 +134,25 @@ int first_scanline_in_display = -1;
 int last_scanline_before_display = 0; //first line must always be vsync, according to ToastyX.
 //future: Mark Rejhon reports that D3DKMTGetScanLine takes 8 scanlines on his 1080 Ti; maybe his code has a problem? he suspects maybe it's just slow on Nvidia cards
 //future: Mark Rejhon reports that the scanline counter doesn't increment properly in the porch (when InVerticalBlank is true). I should investigate that when I get a new graphics card. it works fine on my Intel HD 4000
-uint get_scanline() {
+uint get_scanline(bool& in_vertical_blank) {
 	auto result = D3DKMTGetScanLine(&scanline_windows); //runtime is 0.005-0.015 ms on my Intel HD 4000. 1000 calls in a loop takes 2-5 ms.
 	//standard deviation is 0.004 ms. Quantization error of the scanline is (16.666/1125/sqrt12 = 0.00427 ms). that means D3DKMTGetScanLine() is perfectly accurate up to its theoretical limit.
 	check_assert(result == STATUS_SUCCESS, "scanline error", result); //happens if you're doing double buffer vsync
 
 	//outc(scanline_windows.ScanLine, scanline_windows.InVerticalBlank);
+	in_vertical_blank = scanline_windows.InVerticalBlank;
 	return scanline_windows.ScanLine;
 }
 
 //use InVerticalBlank to determine the boundary between the vblank and display.
 //separate this from get_scanline - there's a timer after the scanline call, and this should be after the timer.
-void update_scanline_boundaries() {
+//it gets the read's values instead of looking at scanline_windows: with the sampler thread, the read is on that thread, and this runs later on the render thread, which reads the boundaries.
+void update_scanline_boundaries(uint read, bool in_vertical_blank) {
 	check_assert(first_scanline_in_display != last_scanline_before_display, "overlapping scanlines in vblank, should be impossible");
 	if (first_scanline_in_display == last_scanline_before_display + 1) //nothing more to be done, it's as good as it gets. this happens very quickly so it's worth bailing out.
 		return;
-	int scanline = scanline_windows.ScanLine; //signed
-	if (scanline_windows.InVerticalBlank) {
+	int scanline = read; //signed
+	if (in_vertical_blank) {
 		if (scanline > last_scanline_before_display && scanline < first_scanline_in_display) {
 			last_scanline_before_display = scanline;
 			scanlines_between_sync_and_first_displayed_line = last_scanline_before_display + 1;
@@ -239,6 +236,9 @@ void get_scanline_info() {
 		total_scanlines = first_total_scanlines;
 		active_scanlines = mode.targetMode.targetVideoSignalInfo.activeSize.cy;
 		porch_scanlines = total_scanlines - active_scanlines;
+		auto vsync_frequency = mode.targetMode.targetVideoSignalInfo.vSyncFreq; //a rational, such as 60000/1001. glfw rounds it to an integer
+		if (vsync_frequency.Denominator != 0)
+			modeline_Hz = double(vsync_frequency.Numerator) / vsync_frequency.Denominator;
 		//outc("porch active total", porch_scanlines, active_scanlines, total_scanlines);
 	}
 }
@@ -278,4 +278,5 @@ void get_scanline_info() {
 //DISPLAYCONFIG_DESKTOP_IMAGE_INFO seems to specify the rectangle. but Windows 10 only
 
 //IDXGIOutput::WaitForVBlank exists. no idea if it's better than D3DK but since scanlines are better than both, I stopped caring.
+bool d3dkmt_registered = register_vblank_source({.name = "d3dkmt", .capabilities = capability_heartbeat | capability_scanline, .wait_for_vblank = wait_for_vblank, .read_scanline = get_scanline, .after_scanline = update_scanline_boundaries});
 #endif
\ No newline at end of file
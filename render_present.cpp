@@ -4,6 +4,7 @@
 #include "platform_vsync.cpp"
 #include "renderer.h"
 #include "timing.h"
+#include "vblank_source.cpp"
 #include "vsync.cpp"
 #include <atomic>
 
@@ -21,11 +22,12 @@ float user_desired_phase_offset = 0; //from 0 to 1. as a ratio of a single frame
 //low value = top of screen, near-1 = bottom of screen.
 //future idea: don't present if you're early, use the swapchain instead.
 
-#if SYNC_IN_SEPARATE_THREAD
+//the heartbeat thread, for a source with capability_heartbeat. the estimators subscribe with subscribe_heartbeat()
 uint64_t vblank_time() {
-	while (wait_for_vblank()) {
+	while (active_vblank_source->wait_for_vblank()) {
 		outc("failure to receive vsync heartbeat (computer probably went to sleep)");
-		vf::restart(now());
+		push_vsync_event({now(), event_heartbeat_lost, source_vf, vf.precise.elements(), 0, 0});
+		vf.restart(now());
 	}
 	//native_sleep_at_most(random_number() / float(random_fo::max()) * ticks_per_sec / 10); //add artificial noise, up to 100 ms
 	return now();
@@ -37,13 +39,13 @@ void get_vsynctimes() {
 		auto newest_timepoint = vblank_time();
 		//native_sleep_at_most(ticks_per_sec / 120); //idea: the massive jumps in vsync cut when the mouse moves are because the rendering is colliding with something. so maybe sleeping will offset this thread? result: nope, doesn't help.
 		//it also doesn't help if I change input_and_render_separate_threads to false.
-		vf::new_value(newest_timepoint);
+		publish_heartbeat(newest_timepoint);
 		//outc("vsync finder took", 1000 * (now() - newest_timepoint) / float(ticks_per_sec)); //this is for benchmarking the finder
-		//if (vf::elements() > 16) outc("jitter in vblank signal", 1000 * vf::calc_error_in_shitty_way() / ticks_per_sec); //this is for benchmarking the input signal accuracy
+		//if (vf.precise.elements() > 16) outc("jitter in vblank signal", 1000 * vf.precise.best().calc_error_in_shitty_way() / ticks_per_sec); //this is for benchmarking the input signal accuracy
 		//somehow, outputting here causes the tearline to wobble!
 
 		//static uint64_t vblank_history[2] = {};
-		//auto phase = vf::vblank_phase_atomic.load();
+		//auto phase = vf.estimate.load().phase;
 		//uint64_t difference_this_frame = phase - vblank_history[1];
 		//uint64_t difference_last_frame = vblank_history[1] - vblank_history[0];
 		//int milli_error = int(std::log(float(difference_this_frame) / difference_last_frame) * 1000);
@@ -54,21 +56,20 @@ void get_vsynctimes() {
 		//note that pressing 2 then 3 causes a giant shift, because it's not receiving any vblank signals
 
 		//this is used to compare two finders to each other, to see which one is lagging. one will have many points, one will have few
-		//vf2::new_value(newest_timepoint);
-		//double diff = int64_t(vf::vblank_phase_atomic - vf2::vblank_phase_atomic);
-		//if (vf::elements() == vf::max_size && vf2::elements() == vf2::max_size) {
-		//	double diff_ratio = diff / vf2::calc_error();
-		//	static double trailing_diff_ratio = 2.0 / vf::max_size;
+		//vf already runs one of each, vf.fast and vf.precise. for other sizes, declare another finder next to vf, like "vsync_finder<512> vf2;", and feed it here.
+		//double diff = int64_t(vf.fast.estimate.load().phase - vf.precise.estimate.load().phase);
+		//if (vf.fast.elements() == 16 && vf.precise.elements() == 256) {
+		//	double diff_ratio = diff / vf.precise.best().calc_error_in_shitty_way();
+		//	static double trailing_diff_ratio = 2.0 / 16;
 		//	trailing_diff_ratio = 0.9999 * trailing_diff_ratio + 0.0001 * diff_ratio;
 		//	static double trailing_diff_abs = 0;
 		//	trailing_diff_abs = 0.9999 * trailing_diff_abs + 0.0001 * diff;
 		//	static double trailing_error = 0;
-		//	trailing_error = 0.9999 * trailing_error + 0.0001 * vf2::calc_error();
+		//	trailing_error = 0.9999 * trailing_error + 0.0001 * vf.precise.best().calc_error_in_shitty_way();
 		//	outc(trailing_diff_ratio, trailing_diff_abs, trailing_error);
 		//}
 	}
 }
-#endif
 
 void swap_now() {
 	if (render::double_buffered)
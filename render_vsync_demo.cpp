@@ -20,6 +20,42 @@
 #include "platform_vsync.cpp" //platform-specific APIs for finding the vsync point
 #include "vsync.cpp" //calculates phase and period when vsync is grabbed in a separate thread
 #include "vsync_with_scanline.cpp" //calculates phase and period when the scanline is grabbed in the render thread
+#include "scanline_sampler.cpp" //reads the scanline in its own thread, when sample_scanline_in_thread is set
+#include "vblank_fusion.cpp" //fuses the above, when fuse_vblank_sources is set
+#include "vblank_source.cpp" //the platform's ways of reading the display, and who listens to them
+
+//the estimators' subscriptions to the active vblank_source. each runs on the thread that made the read: the heartbeat thread for vf, the render thread (or the sampler's drain) for the rest
+void heartbeat_to_vf(uint64_t timepoint) { vf.new_value(timepoint); }
+
+void scanline_to_vscan(uint64_t timepoint, uint scanline) {
+	vscan::new_value(timepoint, scanline);
+	if (render::fuse_vblank_sources)
+		fusion.add(source_vscan, vscan::latest);
+}
+
+//a counter read is a vblank the platform already timestamped, so it needs no estimator. the period is the average since the previous new vblank, quantized to the platform's clock (1 us for OML)
+vblank_estimate counter_estimate;
+vblank_counter_read previous_counter_read;
+void counter_to_estimate(const vblank_counter_read& read) {
+	vblank_counter_read previous = previous_counter_read;
+	previous_counter_read = read;
+	if (read.count < previous.count) //the driver reset the counter, probably a mode change. the period below would be junk, so skip it
+		push_vsync_event({read.timestamp, event_oml_counter_reset, source_oml, 0, counter_estimate.period, 0});
+	else if (read.count != previous.count) {
+		counter_estimate.phase = read.timestamp;
+		if (previous.count != 0) {
+			counter_estimate.period = double(int64_t(read.timestamp - previous.timestamp)) / (read.count - previous.count);
+			if (modeline_Hz && std::abs(counter_estimate.period * modeline_Hz / ticks_per_sec - 1) > 0.01)
+				push_vsync_event({read.timestamp, event_oml_period_jump, source_oml, 0, counter_estimate.period, 0});
+		}
+		if (render::fuse_vblank_sources) //a single vblank, so it has no window. the period over the last reads is quantized, which the fusion learns
+			fusion.add(source_oml, {.phase = counter_estimate.phase, .period = previous.count != 0 ? counter_estimate.period : 0, .generation = uint64_t(read.count)});
+	}
+}
+
+//which reads are made. sync_mode picks one kind, and fuse_vblank_sources makes every kind the source has, so that every estimator feeds the fusion. main() sets them, before the threads start
+bool heartbeat_running = false;
+bool reading_scanlines = false;
 
 #define MEASURE_SWAP 1
 
@@ -40,10 +76,10 @@ void render_loop() {
 	check(gladLoadGLLoader((GLADloadproc)glfwGetProcAddress), "GLAD initialization failed");
 #endif
 
-#if SYNC_LINUX
-	prepare_sync();
+#if ANY_SYNC_SUPPORTED
+	if (active_vblank_source->prepare)
+		active_vblank_source->prepare();
 #endif
-	get_scanline_info();
 
 	triangles.program = compile_shaders(R"(#version 330 core
 layout (location = 0) in mediump vec2 pos;
@@ -98,17 +134,14 @@ void main() {
 
 		//vscan gives slightly less error if the scanline is before the timepoint. however, it's marginal: 0.0042 ms vs 0.0044 ms. it wobbles too. hard to tell if it's just noise.
 		//if it's spam-swapping, we could get it only once per vsync. however, I think I don't care.
-#if SYNC_IN_RENDER_THREAD && SCANLINE_VSYNC
-		uint64_t scanline;
-		if (sync_mode == sync_in_render_thread) {
-			scanline = get_scanline();
-			vscan::new_value(time_at_frame_start, scanline); //we reuse the time at frame start. that forces our scanline operation to be next to it, so there is no decision on where in a frame the scanline retrieval should be.
-			update_scanline_boundaries();
+#if ANY_SYNC_SUPPORTED
+		if (reading_scanlines) {
+			if (sample_scanline_in_thread)
+				vscan::sampler.drain(active_vblank_source->after_scanline); //the sampler thread read them. the source's after_scanline() runs here, so the porch's boundaries are only written on this thread
+			else
+				poll_scanline(*active_vblank_source, time_at_frame_start); //we reuse the time at frame start. that forces our scanline operation to be next to it, so there is no decision on where in a frame the scanline retrieval should be.
 		}
-#endif
-
-#if SYNC_LINUX
-		get_sync_values();
+		poll_counter(*active_vblank_source); //does nothing if the source has no counter
 #endif
 
 		//whether you are trying to sync to the vsync point by waiting and swapping at a tearline
@@ -127,18 +160,23 @@ void main() {
 		bool measure_GPU_time_spent = false;
 
 #if ANY_SYNC_SUPPORTED
-		uint64_t vblank_phase;
-		double vblank_period;
-		if (sync_mode == sync_in_render_thread) {
-			vblank_phase = vscan::phase;
-			vblank_period = vscan::period;
-		}
-		else if (sync_mode == separate_heartbeat) {
-			vblank_phase = vf::vblank_phase_atomic.load(std::memory_order_relaxed);
-			vblank_period = vf::vblank_period_atomic.load(std::memory_order_relaxed);
+		vblank_estimate estimate;
+		if (fuse_vblank_sources) {
+			if (heartbeat_running)
+				fusion.add(source_vf, vf.estimate.load()); //the fusion lives in the render thread, so vf's estimates are collected here. a repeated one is skipped
+			estimate = fusion.estimate.load();
 		}
+		else if (sync_mode == sync_in_render_thread && active_vblank_source->has(capability_scanline))
+			estimate = {.phase = vscan::phase, .period = vscan::period, .drift = vscan::drift};
+		else if (sync_mode == sync_in_render_thread)
+			estimate = counter_estimate;
+		else if (sync_mode == separate_heartbeat)
+			estimate = vf.estimate.load(); //one consistent snapshot. reading phase and period separately could pair a new phase with an old period
 		else
 			error_assert("implement me");
+		estimate = extrapolate_estimate(estimate, time_at_frame_start); //the estimate may be a few frames old. with drift, the period here isn't the period at its phase
+		uint64_t vblank_phase = estimate.phase;
+		double vblank_period = estimate.period;
 
 		if (!spam_swap && vsync_period_phase_info_available)
 			measure_GPU_time_spent =
@@ -150,10 +188,10 @@ void main() {
 		//if frames are surely on time, it's worth syncing to vblank.
 		bool wait_and_tear = measure_GPU_time_spent && frame_time_smoothed < vblank_period / ticks_per_sec; //we need this. be safe if the vsync finder returns junk values. so bail out after calculation
 
-		//if period is more than one second. it's probably bogus information.
+		//if period is more than one second, or there's no period yet. it's probably bogus information.
 		//if phase is more than 100 seconds away. it's not likely to be accurate.
 		//in both cases, just ignore it and spam-swap until we get real data
-		if (vblank_period > ticks_per_sec || (uint64_t)std::abs(int64_t(vblank_phase - time_at_frame_start)) > ticks_per_sec * 10) {
+		if (vblank_period > ticks_per_sec || vblank_period <= 0 || (uint64_t)std::abs(int64_t(vblank_phase - time_at_frame_start)) > ticks_per_sec * 10) {
 			wait_and_tear = false;
 		}
 
@@ -272,8 +310,8 @@ void main() {
 			//INTEL_GPU_BOOST_FREQ_ON_AC=100
 			//INTEL_GPU_MIN_FREQ_ON_AC=100
 
-			//vf::new_value(now()); //for testing how accurate GPU wakeup is. turn on double buffer vsync, (it's not possible with separate_heartbeat_vsync, because it collides with the vsync finder. you'd need to copy a new one into a separate namespace)
-			//if (vf::elements() > 16) outc("jitter:", vf::calc_error_in_shitty_way() * 1000.0 / ticks_per_sec);
+			//vf.new_value(now()); //for testing how accurate GPU wakeup is. turn on double buffer vsync, (if you want this together with separate_heartbeat, it would collide with the vsync finder. so declare a second vsync_finder and feed that one instead)
+			//if (vf.precise.elements() > 16) outc("jitter:", vf.precise.best().calc_error_in_shitty_way() * 1000.0 / ticks_per_sec);
 		}
 
 		if (measure_GPU_time_spent) {
@@ -302,6 +340,25 @@ void main() {
 }
 } // namespace render
 
+//drains vsync_events, and prints a summary once a minute. the printing happens here instead of on the vsync or render thread, so it can't make the tearline wobble
+void report_vsync_events() {
+	vsync_event_counts counts;
+	uint64_t last_report = now();
+	while (!time_to_exit()) {
+		sleep_at_most(ticks_per_sec / 10);
+		counts.drain();
+		if (now() - last_report < 60 * ticks_per_sec)
+			continue;
+		last_report = now();
+		outc("vsync events:", counts.counts[event_restart] / counts.hours(), "restarts per hour, dropped", counts.dropped());
+		vblank_estimate estimate = vf.estimate.load();
+		outc("period drift:", estimate.drift, "ppm/s, vblanks per timepoint", estimate.cadence); //a display clock that keeps drifting after warming up is thermally unstable
+		for (uint reason = 0; reason < event_reason_count; ++reason)
+			if (counts.counts[reason])
+				outc("\t", event_reason_name(vsync_event_reason(reason)), counts.counts[reason]);
+	}
+}
+
 void mouse_cursor_callback(GLFWwindow* window, double xpos, double ypos) {
 	render::mouse_x = xpos + 0.5;
 	render::mouse_y = render::screen_h - ypos - 0.5;
@@ -332,19 +389,47 @@ int main(int argc, char** argv) {
 	glfwSetCursorPosCallback(window, mouse_cursor_callback);
 
 	auto monitor_Hz = get_refresh_rate();
+	get_scanline_info(); //before the vsync thread starts, since the finder wants the modeline's refresh rate
 	extern double system_claimed_monitor_Hz;
-	system_claimed_monitor_Hz = monitor_Hz;
+	system_claimed_monitor_Hz = modeline_Hz ? modeline_Hz : monitor_Hz; //glfw's refresh rate is an integer, so the modeline's is better
+#if ANY_SYNC_SUPPORTED
+	vblank_source* source = select_vblank_source(vblank_source_name);
+	check(source, "no vblank source named", vblank_source_name);
+	if (sync_mode == separate_heartbeat)
+		check(source->has(capability_heartbeat), source->name, "can't wait for the vblank");
 	if (sync_mode == sync_in_render_thread)
-		vscan::period = ticks_per_sec / double(monitor_Hz);
-	else if (sync_mode == separate_heartbeat)
-		vf::vblank_period_atomic.store(ticks_per_sec / double(monitor_Hz), std::memory_order_relaxed);
+		check(source->has(capability_scanline) || source->has(capability_counter), source->name, "has neither a scanline nor a vblank counter");
+	subscribe_heartbeat(heartbeat_to_vf);
+	subscribe_scanline(scanline_to_vscan);
+	subscribe_counter(counter_to_estimate);
+	heartbeat_running = sync_mode == separate_heartbeat || (fuse_vblank_sources && source->has(capability_heartbeat));
+	reading_scanlines = (sync_mode == sync_in_render_thread || fuse_vblank_sources) && source->has(capability_scanline);
+#endif
+	if (sync_mode == sync_in_render_thread || reading_scanlines) {
+		vscan::period = ticks_per_sec / system_claimed_monitor_Hz;
+		counter_estimate.period = vscan::period;
+		vscan::set_window(vscan::rectangular_window); //vscan::exponential_window follows drift more smoothly, in constant memory
+	}
+	if (heartbeat_running) {
+		vf.estimate.store({.period = ticks_per_sec / system_claimed_monitor_Hz});
+		vf.set_nominal_period(ticks_per_sec / system_claimed_monitor_Hz, modeline_Hz ? 0.01 : 0.03); //an integer Hz can be 1.7% off (59 for 59.94)
+		vf.set_estimator(hull_estimator); //pll_estimator follows the vblank with a loop instead of a window. same accuracy on exponential wakeups, worse with rare very late ones
+	}
+	if (fuse_vblank_sources)
+		fusion.estimate.store({.period = ticks_per_sec / system_claimed_monitor_Hz});
 
-#if SYNC_IN_SEPARATE_THREAD
-	if (render::sync_mode == separate_heartbeat) {
+#if ANY_SYNC_SUPPORTED
+	if (heartbeat_running) {
 		std::thread vsync_timer(get_vsynctimes);
 		vsync_timer.detach();
 	}
+	if (reading_scanlines && render::sample_scanline_in_thread) {
+		std::thread scanline_reader([] { vscan::sampler.run(active_vblank_source->read_scanline, time_to_exit); });
+		scanline_reader.detach();
+	}
 #endif
+	std::thread event_reporter(report_vsync_events);
+	event_reporter.detach();
 
 	render::render_loop();
 	glfwTerminate();
@@ -50,6 +50,9 @@ single_def const int sync_mode = sync_in_render_thread;
 #else
 single_def const int sync_mode = double_buffer_vsync; //double_buffer_vsync is default choice
 #endif
+single_def const char* const vblank_source_name = ""; //"" = the platform's own vblank_source. "synthetic" feeds the estimators from a simulated display instead, see vblank_source.cpp
+single_def const bool sample_scanline_in_thread = false; //whenever scanlines are read: with sync_in_render_thread, or with fuse_vblank_sources whatever sync_mode is. vscan's points come from scanline_sampler's thread, several per refresh, instead of one per rendered frame, and with fusion they reach it through vscan
+single_def const bool fuse_vblank_sources = false; //sync to vblank_fusion, which weighs every estimator by its error, instead of to the one sync_mode picks. every read the vblank_source has is made, whatever sync_mode is: vf, vscan, and OML
 //future: alt-tabbing away and back makes the music bar very consistent. why?
 
 #if _WIN32
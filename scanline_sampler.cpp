@@ -0,0 +1,72 @@
+#pragma once
+#include "timing.h"
+#include "vblank_source.cpp" //publish_scanline
+#include "vsync_events.cpp" //event_ring
+#include "vsync_with_scanline.cpp"
+#include <cstdint>
+
+//vscan used to get one scanline per rendered frame, read in the render thread next to time_at_frame_start. so it got as many points as the renderer drew frames, at whatever part of the frame the renderer happened to be in.
+//a renderer that spam-swaps or stalls gave it bursts and gaps, and a heavy scene made every read late. the estimator's quality followed the rendering load.
+//the sampler is a thread that only reads the scanline: samples_per_frame times per refresh, at scanlines spread evenly down the frame. it doesn't render, so its reads come on time.
+//	each read is timestamped on both sides, and the timepoint is the middle. a read that took longer than max_read was preempted somewhere in the middle, so its time is unknown, and it's dropped.
+//	the points go through a lock-free ring to the render thread, which drains it to the scanline subscribers (vscan) in order. vscan stays single-threaded, and the render thread spends no time reading.
+//	the source's after_scanline() runs at the drain too, not on the sampler thread: on Windows it moves the porch's boundaries, which the render loop reads when it aims the tearline. so each sample carries its read's InVerticalBlank.
+//vscan doesn't mind several points in one frame: the frame is unwrapped from the time and the scanline, not counted.
+//	so 4 points per frame fill the window 4 times faster, and the window spans a quarter of the time. set vscan's window longer, or use the exponential window, if you want the same span.
+//simulated at 59.94 Hz and 1125 lines, with 0.5 scanlines of read jitter, 3 us of timestamp noise and 1 ppm/s drift. rms and mean error of the next vblank:
+//	from the render thread, frames of 0.3-1 periods with 5% stalls, and a 10 us exponential delay between the frame's timepoint and the read: 1.6 us rms, 8.4 us late. at twice the load, 2.4 us rms, 16 us late.
+//	from the sampler at 4 per frame and no load: 1.1 us rms, -0.12 us. the exponential window, 1.0 us, and 8 per frame doesn't help further.
+struct scanline_sample {
+	uint64_t timepoint = 0; //ticks, the middle of the read
+	uint scanline = 0;
+	bool in_vertical_blank = false;
+};
+
+namespace vscan {
+struct scanline_sampler {
+	event_ring<scanline_sample, 1024> queue; //a second of points at 4 per frame and 240 Hz. if the render thread stalls longer than that, the newest points are dropped, which vscan sees as a gap
+	uint samples_per_frame = 4;
+	double max_read = 50e-6; //seconds. D3DKMTGetScanLine takes 5-15 us
+	uint64_t reads = 0; //the sampler's side
+	uint64_t slow_reads = 0;
+	uint next_slot = 0;
+
+	//the thread's body. read_scanline is the vblank_source's read_scanline(). it touches nothing but the queue and the counts, which only this thread writes
+	void run(uint (*read_scanline)(bool& in_vertical_blank), bool (*stop)()) {
+		while (!stop()) {
+			bool in_vertical_blank = false;
+			uint64_t before = now();
+			uint scanline = read_scanline(in_vertical_blank);
+			uint64_t after = now();
+			++reads;
+			if (after - before > uint64_t(max_read * ticks_per_sec))
+				++slow_reads;
+			else
+				queue.push({before + (after - before) / 2, scanline, in_vertical_blank});
+
+			//the next read is at the next slot's scanline. the claimed rate is good enough to aim with, since only the timestamps have to be exact
+			next_slot = (next_slot + 1) % samples_per_frame;
+			uint target = uint((next_slot + 0.5) * total_scanlines / samples_per_frame);
+			int lines_ahead = int(target) - int(scanline);
+			if (lines_ahead <= 0)
+				lines_ahead += total_scanlines;
+			sleep_at_most(int64_t(lines_ahead * ticks_per_sec / (system_claimed_monitor_Hz * total_scanlines)));
+		}
+	}
+
+	//the render thread's side. publishes everything queued, in the order it was read, and hands each read to after_read, the vblank_source's after_scanline(), if it has one. returns how many points it published
+	uint drain(void (*after_read)(uint scanline, bool in_vertical_blank)) {
+		scanline_sample sample;
+		uint fed = 0;
+		while (queue.pop(sample)) {
+			publish_scanline(sample.timepoint, sample.scanline);
+			if (after_read)
+				after_read(sample.scanline, sample.in_vertical_blank);
+			++fed;
+		}
+		return fed;
+	}
+};
+
+scanline_sampler sampler; //started by the demo when render::sample_scanline_in_thread is set
+} // namespace vscan
@@ -0,0 +1,52 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstring> //memcpy
+#include <type_traits>
+
+//one writer, any number of readers. neither side ever takes a lock, and the writer never waits.
+//the reader does one acquire load of the sequence number, copies the payload, then checks that the sequence didn't move. if the writer got in the way, it copies again.
+//the writer publishes at most once per vblank, so in practice the reader never retries.
+//the payload is stored as relaxed atomic words instead of a plain T. a torn copy is then not a data race; it's detected by the sequence check and thrown away.
+template <typename T>
+struct seqlock {
+	static_assert(std::is_trivially_copyable_v<T>, "seqlock copies the payload with memcpy");
+	static constexpr size_t words = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+	std::atomic_uint64_t sequence = 0; //odd while the writer is in the middle of a store
+	std::atomic_uint64_t payload[words] = {};
+
+	seqlock() { store(T{}); }
+	//copying takes a snapshot. this lets an object that publishes through a seqlock be copied, as long as the copy isn't being read yet
+	seqlock(const seqlock& other) { store(other.load()); }
+	seqlock& operator=(const seqlock& other) {
+		store(other.load());
+		return *this;
+	}
+
+	void store(const T& value) {
+		uint64_t buffer[words] = {};
+		memcpy(buffer, &value, sizeof(T));
+		uint64_t s = sequence.load(std::memory_order_relaxed);
+		sequence.store(s + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release); //the odd sequence number must be visible before any of the new payload
+		for (size_t x = 0; x < words; ++x)
+			payload[x].store(buffer[x], std::memory_order_relaxed);
+		sequence.store(s + 2, std::memory_order_release);
+	}
+
+	T load() const {
+		uint64_t buffer[words];
+		while (1) {
+			uint64_t s = sequence.load(std::memory_order_acquire);
+			for (size_t x = 0; x < words; ++x)
+				buffer[x] = payload[x].load(std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_acquire); //the payload loads must complete before the sequence is checked again
+			if (!(s & 1) && sequence.load(std::memory_order_relaxed) == s)
+				break;
+		}
+		T value;
+		memcpy(&value, buffer, sizeof(T));
+		return value;
+	}
+};
@@ -0,0 +1,34 @@
+#pragma once
+#include "seqlock.h"
+#include "timing.h"
+#include <cmath>
+#include <cstdint>
+
+//everything an estimator tells the renderer about the vblank. it's published as a single unit, so the phase and period the renderer reads always belong together.
+struct vblank_estimate {
+	uint64_t phase = 0; //timepoint of a vblank. it's a uint64_t, not a double, because this is a circular clock
+	double period = 0; //ticks per frame. it's a double, which marginally improves rounding accuracy
+	uint64_t period_numerator = 0; //the line's exact period is period_numerator / period_denominator. period differs from it by the drift, see below. an estimator without an exact ratio leaves the denominator at 0
+	uint64_t period_denominator = 0;
+	unsigned elements = 0; //how many timepoints the estimate is built from
+	unsigned window_size = 0; //how many timepoints the estimator would keep at most. a self-tuning finder changes it at runtime. 0 if the estimator has no window
+	double error = 0; //average distance of the timepoints from their vblanks, in ticks
+	double phase_correction = 0; //how far the phase was moved earlier, because the timepoints it's built from are late. ticks. already applied to phase
+	unsigned cadence = 0; //the timepoints arrive every cadence vblanks, like a compositor that only delivers every other vblank. period is still the display's. 0 if the estimator doesn't know
+	double drift = 0; //ppm per second: how fast the period changes, relative to itself. from clock skew, like a display clock warming up. 0 if the estimator doesn't measure it, or doesn't know yet
+	uint64_t generation = 0; //counts publications, so a reader can tell whether the estimate is new
+};
+
+//moves the phase to the vblank nearest time, and the period to the period there.
+//the period is only right at the phase. the further you extrapolate, the more the drift adds up: the period changes by drift * elapsed time, and the phase by the integral of that.
+//without drift, the phase moves by whole periods, which changes nothing.
+inline vblank_estimate extrapolate_estimate(vblank_estimate estimate, uint64_t time) {
+	if (estimate.period <= 0)
+		return estimate;
+	double rate = estimate.drift * 1e-6 / ticks_per_sec; //relative change of the period per tick
+	double frames = std::nearbyint(double(int64_t(time - estimate.phase)) / estimate.period);
+	double elapsed = frames * estimate.period * (1 + rate * frames * estimate.period / 2);
+	estimate.phase += std::llround(elapsed);
+	estimate.period *= 1 + rate * frames * estimate.period;
+	return estimate;
+}
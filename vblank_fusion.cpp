@@ -0,0 +1,362 @@
+#pragma once
+#include "console.h"
+#include "seqlock.h"
+#include "timing.h"
+#include "vblank_estimate.h"
+#include "vsync_events.cpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+//the render loop used to sync to one estimator, picked by sync_mode at compile time. but a vblank_source can have several kinds of read, and each feeds its own estimator: a heartbeat feeds vf, a scanline feeds vscan, and a counter is OML.
+//	D3DKMT on Windows has a heartbeat and a scanline. Linux only has OML's counter, so there's nothing to fuse it with. the synthetic source has all three.
+//they have independent errors: vf is late by a wakeup, vscan is noisy by the scanline readout, and OML is quantized to 1 us. weighting them by their errors beats each of them, and it keeps going if one of them stops.
+//so this is a Kalman filter on the vblank: phase, period, and the period's change per frame. every estimate a source publishes is a measurement of the phase, and of the period if the source has one.
+//	the measurement is of the vblank nearest to it, so the sources don't have to agree on which vblank they report.
+//vf and vscan don't report vblanks, they report regressions over hundreds of frames. so their error isn't new with every estimate: it wanders slowly, and the next estimate repeats most of it.
+//	a filter that took that for fresh noise would average it down, and trust a lone vscan far more than it should. with several sources, the one with the slowest wander would win no matter how large it is.
+//	so each source also has a bias in the state: a wander that decays over half the source's window (Gauss-Markov), plus white noise. a source with no window, like OML, is all white noise.
+//	the bias takes window - 1 parts of the source's variance, and the white noise 1 part.
+//a source's noise isn't known in advance, and it changes with the load. so it's learned from the innovations: their average square is the state's variance (HPH') plus the white noise's, and the white noise's is the rest.
+//	a measurement more than gate standard deviations away is thrown out. its square still teaches the variance, capped at the gate, so a source that got noisier widens its own gate instead of being ignored forever.
+//	if reset_after measurements in a row are thrown out, from whatever sources, the tracker is wrong, not the sources. it starts over.
+//the sources don't agree on where the vblank is: vf wakes up at the start of the front porch, and OML stamps a different edge than the scanline's wraparound. that's a constant offset, not noise.
+//	so the fused phase is the reference source's vblank, and every other source carries an offset from it: a lowpass of the distance from its vblanks to the reference's latest.
+//	it's measured against the reference directly, not against the fused phase. otherwise the strongest source would pull the fused phase, its offset would follow, and the phase would wander off the reference.
+//	the reference is the source with the lowest averaged_variance(), since the offsets average it over hundreds of frames, and inherit what's left. when it goes quiet, the next best takes over with its offset frozen, so the phase doesn't jump.
+//	it used to be the lowest spread. OML's is only 2.3x below vf's, so vf stayed the reference, and the fused phase followed vf's wander through OML's offset.
+//the filter is only as good as its model. a source that adds almost nothing to it still adds its model's mistakes, so a source with less than negligible_share of the information is left out. it still teaches its noise, so it comes back when it's needed.
+//	so with OML, the fused phase is OML's through the filter: vf and vscan add well under 1% of the information. and when OML stops, they're all that's left, and they come back in.
+//a lone source with a window is served as it is, with its offset, and the filter only runs beside it. its window already averages it, and it follows a mode change as soon as its estimator does.
+//	through the filter, vf alone was steadier, 0.23 us against 0.57 us, but the model has no period step: after a mode change, the filter took the step as noise and followed it late.
+//	OML reports single vblanks, with the period of one frame. it needs the filter to average them, alone or not.
+//	that period is the difference of two phases the filter already took, so it isn't measured again. taken as a fresh measurement, its error counted twice, and OML alone wandered off by 5 ms.
+//vsync_benchmark.cpp simulates it at 59.94 Hz with 1 ppm/s of drift: vf waking up 20 us late on average, vscan reading the scanline 3 us late, and OML quantized to 1 us with 0.3 us of jitter. every combination sees the same trace.
+//	the phases sit on different edges, so this is the spread of the phase around its mean, not its distance from the vblank:
+//	alone: vf 0.57 us, vscan 1.15 us, OML through the filter 0.0219 us.
+//	fused: all three 0.0219 us, vf and OML 0.0219 us, vscan and OML 0.0219 us, vf and vscan 0.18 us. with OML stopping halfway, all three are 0.12 us over the whole run.
+struct vblank_source_noise {
+	double white = 0; //ticks^2. the variance of the source's white noise. 0 until its first measurement
+	double period_variance = 0; //ticks^2
+	double spread = 0; //ticks^2. mean square distance of the phases from the trend, bias and all. the model's variances can be fooled by a source whose error wanders, this can't
+	double window = 1; //frames that one estimate shares with the next, from its elements. 1 for a source that reports single vblanks
+	uint64_t generation = 0; //of the last estimate taken, so an estimate read twice isn't measured twice
+	uint64_t last_update = 0; //ticks
+	uint64_t measurements = 0;
+	uint64_t rejected = 0;
+	double offset = 0; //ticks. how much later this source's vblanks are than the reference's
+	bool aligned = false; //offset was measured
+
+	double variance() const { return white * window; } //of the whole phase error, bias and white noise
+	double bias_variance() const { return white * (window - 1); }
+	double bias_frames() const { return window / 2; } //the decay time of the bias. a regression's error is mostly replaced after half its window
+	double averaged_variance() const { return (spread > 0 ? spread : variance()) * window; } //what's left after many frames are averaged. white noise averages down, and a bias that lasts window frames averages down window times slower
+};
+
+struct vblank_fusion {
+	seqlock<vblank_estimate> estimate; //the renderer reads this, same as a single finder
+	uint64_t estimates_published = 0;
+	vblank_estimate latest;
+	bool replaying = false;
+
+	//process noise, per frame. the display clock has no jitter, so the phase only moves through the period. the period wanders by a random walk of its slope, which is the drift
+	double phase_noise = 1; //ticks^2. a little, so the filter doesn't lock so hard that it can't follow a source that's right
+	double period_noise = 1e-6; //ticks^2
+	double slope_noise = 1e-12; //(ticks per frame)^2. the slope at 1 ppm/s and 60 Hz is 0.0003 ticks per frame
+	double max_window = 256; //frames. caps vblank_source_noise::window, for a source that counts every point it ever saw
+	double gate = 5; //standard deviations
+	double learning_rate = 1.0 / 64; //of the variances. a source publishes about once per frame, so they follow the load over about a second
+	double minimum_noise = 0.01; //ticks^2. the floor of the variances, so a source that agrees perfectly for a while can't take over completely
+	double initial_noise = 1e-5; //seconds. a variance starts at the square of this, or of the source's own error if it's larger. starting too low makes the filter lock onto the first few measurements, and reject the rest
+	uint reset_after = 8;
+	uint64_t stale_after = 0; //ticks. a source that hasn't published for this long isn't counted in elements. 0: 4 periods
+	double offset_rate = 1.0 / 256;
+	double spread_rate = 1.0 / 4096; //slow, since every switch of the reference leaves its wander in the offsets. vf's and vscan's spreads wander by half over a few hundred frames
+	vsync_event_source reference = source_count; //the source whose vblanks the fused phase marks. the first source to publish, until a better one has reference_after measurements
+	uint64_t reference_phase = 0; //its latest vblank
+	uint64_t reference_after = 4096; //measurements. a source's spread isn't known well enough to take over before that
+	double negligible_share = 0.01; //of the information. a source that adds less than this is left out, see negligible()
+
+	vblank_source_noise sources[source_count];
+	uint rejected_in_a_row = 0;
+
+	//the state, relative to anchor: the vblank is at anchor + state[0], the period there is state[1], and it grows by state[2] per frame.
+	//state[trend + source] is the source's bias: how much later than the vblank its estimates are, beyond its offset
+	static constexpr int trend = 3;
+	static constexpr int size = trend + source_count;
+	uint64_t anchor = 0;
+	double state[size] = {};
+	double covariance[size][size] = {};
+	bool started = false;
+
+	static double sqr(double x) { return x * x; }
+
+	//starts from a single measurement of a source's phase and period
+	void start(const vblank_estimate& measured, const vblank_source_noise& s) {
+		double period = measured.period;
+		anchor = measured.phase;
+		for (int r = 0; r < size; ++r) {
+			state[r] = 0;
+			for (int c = 0; c < size; ++c)
+				covariance[r][c] = 0;
+		}
+		state[1] = period;
+		covariance[0][0] = std::max(s.variance(), minimum_noise);
+		covariance[1][1] = sqr(period * 1e-4); //a regression's period is good to 100 ppm even when it's new
+		covariance[2][2] = sqr(period * period / ticks_per_sec * 100e-6); //100 ppm/s
+		for (int s = 0; s < source_count; ++s)
+			covariance[trend + s][trend + s] = sources[s].bias_variance();
+		started = true;
+		rejected_in_a_row = 0;
+	}
+
+	//how many frames time is after the anchor's vblank, rounded
+	double frames_after_anchor(uint64_t time) { return std::nearbyint((double(int64_t(time - anchor)) - state[0]) / state[1]); }
+
+	//moves the state k frames forward. the trend goes by {{1, k, k^2/2}, {0, 1, k}, {0, 0, 1}}, and each bias decays by exp(-k / bias_frames).
+	//it only moves forward: a source that reports an earlier vblank than another is measured where it is, see add()
+	void predict(double k) {
+		if (k <= 0)
+			return;
+		double F[size][size] = {};
+		F[0][0] = F[1][1] = F[2][2] = 1;
+		F[0][1] = F[1][2] = k;
+		F[0][2] = k * k / 2;
+		for (int s = 0; s < source_count; ++s)
+			F[trend + s][trend + s] = std::exp(-k / sources[s].bias_frames());
+		double x[size] = {};
+		double FP[size][size] = {};
+		for (int r = 0; r < size; ++r)
+			for (int c = 0; c < size; ++c) {
+				if (F[r][c] == 0)
+					continue;
+				x[r] += F[r][c] * state[c];
+				for (int m = 0; m < size; ++m)
+					FP[r][m] += F[r][c] * covariance[c][m];
+			}
+		for (int r = 0; r < size; ++r)
+			for (int c = 0; c < size; ++c) {
+				covariance[r][c] = 0;
+				for (int m = 0; m < size; ++m)
+					covariance[r][c] += FP[r][m] * F[c][m];
+			}
+		covariance[0][0] += phase_noise * k;
+		covariance[1][1] += period_noise * k;
+		covariance[2][2] += slope_noise * k;
+		for (int s = 0; s < source_count; ++s) //so the bias's variance stays at bias_variance
+			covariance[trend + s][trend + s] += sources[s].bias_variance() * (1 - sqr(F[trend + s][trend + s]));
+		//the phase is kept small by moving its whole ticks into the anchor, so the doubles keep their precision
+		double whole = std::floor(x[0]);
+		anchor += int64_t(whole);
+		x[0] -= whole;
+		for (int r = 0; r < size; ++r)
+			state[r] = x[r];
+	}
+
+	//one scalar measurement of H times the state, with white noise of variance noise. returns false if it was gated out
+	bool update(const double (&H)[size], double innovation, double noise) {
+		double PH[size] = {};
+		for (int r = 0; r < size; ++r)
+			for (int c = 0; c < size; ++c)
+				PH[r] += covariance[r][c] * H[c];
+		double S = noise;
+		for (int r = 0; r < size; ++r)
+			S += H[r] * PH[r];
+		if (innovation * innovation > sqr(gate) * S)
+			return false;
+		double gain[size];
+		for (int r = 0; r < size; ++r) {
+			gain[r] = PH[r] / S;
+			state[r] += gain[r] * innovation;
+		}
+		//Joseph form: P = (I - KH) P (I - KH)' + K R K'. the short form P - KHP loses positive definiteness in doubles, since the phase's variance is 10^12 times the slope's
+		double AP[size][size]; //(I - KH) P
+		for (int r = 0; r < size; ++r)
+			for (int c = 0; c < size; ++c)
+				AP[r][c] = covariance[r][c] - gain[r] * PH[c];
+		double APH[size] = {};
+		for (int r = 0; r < size; ++r)
+			for (int m = 0; m < size; ++m)
+				APH[r] += AP[r][m] * H[m];
+		for (int r = 0; r < size; ++r)
+			for (int c = 0; c < size; ++c)
+				covariance[r][c] = AP[r][c] - APH[r] * gain[c] + gain[r] * noise * gain[c];
+		return true;
+	}
+
+	//teaches a white noise's variance from one innovation. the innovation's variance is prior + variance, so the rest of its square is the noise's
+	void learn(double& variance, double innovation, double prior) {
+		double square = std::min(sqr(innovation), sqr(gate) * (prior + variance));
+		variance += (std::max(square - prior, minimum_noise) - variance) * learning_rate;
+	}
+
+	//feeds one estimate from a source. an estimate with the same generation as the last one from that source is skipped, so the render loop can pass whatever it has every frame
+	void add(vsync_event_source source, const vblank_estimate& measured) {
+		vblank_source_noise& s = sources[source];
+		if (measured.phase == 0 || (measured.generation != 0 && measured.generation == s.generation))
+			return;
+		s.generation = measured.generation;
+		s.last_update = measured.phase;
+		++s.measurements;
+		s.window = std::clamp(double(measured.elements), 1.0, max_window);
+		if (s.white == 0) { //the source's own error is a start. the learning takes it from there
+			s.white = std::max(sqr(measured.error), sqr(initial_noise * ticks_per_sec)) / s.window;
+			s.period_variance = measured.period > 0 ? sqr(measured.period * 1e-5) : 0;
+		}
+		choose_reference(source, measured.phase);
+		if (source == reference)
+			reference_phase = measured.phase;
+		else if (started && reference_phase != 0 && std::abs(double(int64_t(measured.phase - reference_phase))) <= 4 * state[1]) { //a stale reference is far away
+			double distance = std::remainder(double(int64_t(measured.phase - reference_phase)), state[1]) + sources[reference].offset;
+			s.offset = s.aligned ? s.offset + (distance - s.offset) * offset_rate : distance;
+			s.aligned = true;
+		}
+		vblank_estimate corrected = measured;
+		corrected.phase -= std::llround(s.offset);
+		bool left_out = negligible(source, measured.phase);
+		bool tracked = track(source, s, measured, corrected, left_out); //it runs even for a lone source, so it's ready when a second one shows up
+		if (left_out)
+			return;
+		if (contributing_sources(measured.phase) == 1 && measured.period > 0 && s.window > 1)
+			publish_alone(corrected);
+		else if (tracked) //a lone source of single vblanks still needs the filter, to average them
+			publish(measured.phase);
+	}
+
+	//the filter's side of add(). returns true if the state took the measurement. a source that's left_out only teaches its noise and its spread, so it can come back in
+	bool track(vsync_event_source source, vblank_source_noise& s, const vblank_estimate& measured, const vblank_estimate& corrected, bool left_out) {
+		if (!started) {
+			if (measured.period > 0)
+				start(corrected, s);
+			return started;
+		}
+
+		//the measurement is of the vblank k frames after the anchor, plus the source's bias: H = {1, k, k^2/2, ..., 1, ...}. and {0, 1, k} for the period there
+		double k = frames_after_anchor(corrected.phase);
+		predict(k);
+		k = std::min(k, 0.0);
+		int b = trend + source;
+		double innovation = double(int64_t(corrected.phase - anchor)) - (state[0] + k * state[1] + k * k / 2 * state[2] + state[b]);
+		//a mode change moves the period by more than the model's drift, and the filter only sees it as innovations. they teach every source a huge noise, the gate opens with it, and nothing is rejected, so reset_after never comes.
+		//	simulated at 59.94 Hz, switching to 59.95 Hz, with vf and vscan: the period stayed at 59.94 Hz, and the phase was 8 ms off when vscan came back in. see vsync_test.cpp
+		//	so the reference is checked against its own error, which the filter doesn't learn. a regression's phase stays well within its points' error, so a trend that misses it by gate of them means the filter is lost, and it starts over
+		if (source == reference && measured.error > 0 && std::abs(innovation + state[b]) > gate * measured.error) {
+			if (!replaying)
+				push_vsync_event({measured.phase, event_restart, source_fusion, unsigned(s.measurements), state[1], std::sqrt(covariance[0][0])});
+			start(corrected, s);
+			return true;
+		}
+		if (source != reference && !s.aligned) { //the reference is gone, so it's measured against the fused phase, once
+			s.offset += innovation;
+			s.aligned = true;
+			innovation = 0;
+		}
+		double H[size] = {1, k, k * k / 2};
+		H[b] = 1;
+		double prior = 0; //H P H'
+		for (int r = 0; r < size; ++r)
+			for (int c = 0; c < size; ++c)
+				prior += H[r] * covariance[r][c] * H[c];
+		learn(s.white, innovation, prior);
+		double distance = sqr(innovation + state[b]);
+		s.spread = s.spread == 0 ? distance : s.spread + (std::min(distance, sqr(gate) * s.spread) - s.spread) * spread_rate;
+		covariance[b][b] = std::min(covariance[b][b], s.bias_variance()); //the variance can shrink, and the bias's prior with it
+		if (left_out)
+			return false;
+		bool accepted = update(H, innovation, s.white);
+		if (accepted && measured.period > 0 && s.window > 1) { //a source of single vblanks measures its period from two phases the filter already took. it isn't new information, and its error is the same as theirs
+			double H_period[size] = {0, 1, k};
+			double innovation_period = measured.period - (state[1] + k * state[2]);
+			learn(s.period_variance, innovation_period, covariance[1][1] + 2 * k * covariance[1][2] + k * k * covariance[2][2]);
+			update(H_period, innovation_period, s.period_variance * s.window); //the period's error wanders like the phase's. without a bias state for it, counting it window times is the nearest thing
+		}
+		if (accepted)
+			rejected_in_a_row = 0;
+		else {
+			++s.rejected;
+			if (!replaying)
+				push_vsync_event({measured.phase, event_fusion_rejected, source, unsigned(s.measurements), measured.period, innovation});
+			if (++rejected_in_a_row >= reset_after) {
+				if (!replaying)
+					push_vsync_event({measured.phase, event_restart, source_fusion, unsigned(s.measurements), state[1], std::sqrt(covariance[0][0])});
+				started = false;
+			}
+			return false;
+		}
+		return true;
+	}
+
+	//the reference should be the most precise source, since the offsets inherit its wander. so a source that's much better takes over, and so does any source when the reference goes quiet.
+	//the new reference keeps its offset, frozen, so the fused phase stays on the first reference's vblanks and doesn't jump
+	void choose_reference(vsync_event_source source, uint64_t time) {
+		if (reference == source_count) {
+			reference = source;
+			return;
+		}
+		vblank_source_noise& s = sources[source];
+		vblank_source_noise& current = sources[reference];
+		if (source == reference || !s.aligned || s.measurements < reference_after)
+			return;
+		bool reference_is_stale = started && std::abs(double(int64_t(time - current.last_update))) > 4 * state[1];
+		if (reference_is_stale || s.averaged_variance() * 4 < current.averaged_variance())
+			reference = source;
+	}
+
+	bool is_live(const vblank_source_noise& s, uint64_t time) {
+		uint64_t stale = stale_after ? stale_after : uint64_t(4 * state[1]);
+		return s.measurements != 0 && int64_t(time - s.last_update) <= int64_t(stale);
+	}
+
+	//the number of sources that published lately. elements in the published estimate
+	unsigned live_sources(uint64_t time) {
+		unsigned live = 0;
+		for (auto& s : sources)
+			live += is_live(s, time);
+		return live;
+	}
+
+	//the filter is only as good as its model, and a source's wander is never quite Gauss-Markov. a source that adds almost nothing still adds its model's mistakes.
+	//with OML, which is white noise once per frame, vf and vscan add well under 1% of the information. fused anyway, vscan and OML were 0.02193 us against OML's own 0.02192 us. so a source whose share is below negligible_share is left out, and the fused phase is the best source's
+	bool negligible(vsync_event_source source, uint64_t time) {
+		double total = 0;
+		for (auto& s : sources)
+			if (is_live(s, time) && s.white > 0)
+				total += 1 / s.averaged_variance();
+		return sources[source].white > 0 && 1 / sources[source].averaged_variance() < negligible_share * total;
+	}
+
+	//the live sources that aren't left out
+	unsigned contributing_sources(uint64_t time) {
+		unsigned contributing = 0;
+		for (int s = 0; s < source_count; ++s)
+			contributing += is_live(sources[s], time) && !negligible(vsync_event_source(s), time);
+		return contributing;
+	}
+
+	//a lone source is served as it is, moved onto the reference's vblanks. through the filter, it only gained lag and noise: vf alone was 0.77 us rms, and 2.3 us through the filter, which started over whenever vf switched finders
+	void publish_alone(const vblank_estimate& corrected) {
+		latest = corrected;
+		latest.elements = 1;
+		latest.generation = ++estimates_published;
+		if (!replaying)
+			estimate.store(latest);
+	}
+
+	void publish(uint64_t time) {
+		unsigned live = live_sources(time);
+		latest.phase = anchor + int64_t(std::llround(state[0]));
+		latest.period = state[1];
+		latest.period_numerator = latest.period_denominator = 0;
+		latest.elements = live;
+		latest.window_size = 0;
+		latest.error = std::sqrt(covariance[0][0]);
+		latest.phase_correction = 0;
+		latest.cadence = 0;
+		latest.drift = state[2] / state[1] / (state[1] / ticks_per_sec) * 1e6; //the slope is the period's change per frame. per second, relative, in ppm
+		latest.generation = ++estimates_published;
+		if (!replaying)
+			estimate.store(latest);
+	}
+};
+
+vblank_fusion fusion; //fed by the render loop, see fuse_vblank_sources
@@ -0,0 +1,179 @@
+#pragma once
+#include "console.h"
+#include "timing.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <mutex> //call_once
+
+extern double system_claimed_monitor_Hz;
+extern int total_scanlines;
+
+//the platform layer used to be wired in with macros: each platform file defined SYNC_IN_RENDER_THREAD, SCANLINE_VSYNC, SYNC_LINUX and so on, and the render loop called get_scanline() or get_sync_values() under #if.
+//so a new way of reading the display meant a new macro and another #if in render_loop(), and there was no way to feed the estimators anything but the real display.
+//now a platform registers vblank_sources. a source says what it can read, in capabilities, and how, in function pointers. the render loop and the heartbeat thread only talk to the active source.
+//	heartbeat: wait_for_vblank() blocks until a vblank. a thread calls it in a loop and timestamps each wakeup, for vf.
+//	scanline: read_scanline() gives the beam's position right now, for vscan, and whether it's in the vertical blank, if the source knows. the read is timestamped by whoever calls it.
+//	counter: read_counter() gives the last vblank's count and timestamp, like OML's MSC and UST. the platform timestamps it, so it needs no estimator, only a period.
+//the estimators don't know about sources either. they subscribe to a kind of read, and publish_*() hands every read to every subscriber, on the thread that made the read.
+//a source that can't read something leaves its function null, and its capability unset. synthetic_display is registered on every platform: a simulated display clock, for benchmarking the estimators against a known vblank.
+enum vblank_capability : unsigned {
+	capability_heartbeat = 1,
+	capability_scanline = 2,
+	capability_counter = 4,
+};
+
+struct vblank_counter_read {
+	uint64_t timestamp = 0; //ticks. when the counted vblank happened
+	int64_t count = 0; //vblanks since some point. it can go backwards, if the driver resets it
+};
+
+struct vblank_source {
+	const char* name = nullptr;
+	unsigned capabilities = 0;
+	bool simulated = false; //never picked unless it's asked for by name
+	void (*prepare)() = nullptr; //optional. runs on the render thread, once its GL context is current
+	bool (*wait_for_vblank)() = nullptr; //returns true on failure, such as the computer going to sleep
+	uint (*read_scanline)(bool& in_vertical_blank) = nullptr; //leaves in_vertical_blank alone if the source can't tell
+	void (*after_scanline)(uint scanline, bool in_vertical_blank) = nullptr; //optional. gets each read after it was timestamped and published, on the thread that publishes it, which is the render thread. Windows uses it to learn the porch's boundaries
+	bool (*read_counter)(vblank_counter_read& read) = nullptr; //returns false on failure
+
+	bool has(unsigned capability) const { return (capabilities & capability) == capability; }
+};
+
+constexpr uint max_vblank_sources = 8;
+vblank_source vblank_sources[max_vblank_sources];
+uint vblank_source_count = 0;
+vblank_source* active_vblank_source = nullptr; //select_vblank_source() sets it, before any thread reads it
+
+//returns true, so that a platform can register from a global's initializer
+bool register_vblank_source(const vblank_source& source) {
+	check(vblank_source_count < max_vblank_sources, "too many vblank sources");
+	vblank_sources[vblank_source_count++] = source;
+	return true;
+}
+
+//an empty name picks the platform's own source: the first registered one that isn't simulated. returns nullptr if there's none
+vblank_source* select_vblank_source(const char* name) {
+	active_vblank_source = nullptr;
+	for (uint x = 0; x < vblank_source_count; ++x) {
+		vblank_source& source = vblank_sources[x];
+		if (name[0] ? std::strcmp(source.name, name) == 0 : !source.simulated) {
+			active_vblank_source = &source;
+			break;
+		}
+	}
+	return active_vblank_source;
+}
+
+//the estimators' side. subscribe before the source's threads start. the lists aren't locked, since nothing subscribes afterward
+constexpr uint max_vblank_subscribers = 4;
+struct vblank_subscriber_lists {
+	void (*heartbeat[max_vblank_subscribers])(uint64_t timepoint) = {};
+	void (*scanline[max_vblank_subscribers])(uint64_t timepoint, uint scanline) = {};
+	void (*counter[max_vblank_subscribers])(const vblank_counter_read& read) = {};
+};
+vblank_subscriber_lists vblank_subscribers;
+
+template <typename function>
+void add_vblank_subscriber(function* (&list)[max_vblank_subscribers], function* subscriber) {
+	for (auto& slot : list)
+		if (!slot) {
+			slot = subscriber;
+			return;
+		}
+	error("too many vblank subscribers");
+}
+void subscribe_heartbeat(void (*subscriber)(uint64_t timepoint)) { add_vblank_subscriber(vblank_subscribers.heartbeat, subscriber); }
+void subscribe_scanline(void (*subscriber)(uint64_t timepoint, uint scanline)) { add_vblank_subscriber(vblank_subscribers.scanline, subscriber); }
+void subscribe_counter(void (*subscriber)(const vblank_counter_read& read)) { add_vblank_subscriber(vblank_subscribers.counter, subscriber); }
+
+void publish_heartbeat(uint64_t timepoint) {
+	for (auto subscriber : vblank_subscribers.heartbeat)
+		if (subscriber)
+			subscriber(timepoint);
+}
+void publish_scanline(uint64_t timepoint, uint scanline) {
+	for (auto subscriber : vblank_subscribers.scanline)
+		if (subscriber)
+			subscriber(timepoint, scanline);
+}
+void publish_counter(const vblank_counter_read& read) {
+	for (auto subscriber : vblank_subscribers.counter)
+		if (subscriber)
+			subscriber(read);
+}
+
+//reads the scanline, and publishes it with timepoint. the render loop passes the frame's start time, so the read must be right next to it. returns false if the source can't read scanlines
+bool poll_scanline(const vblank_source& source, uint64_t timepoint) {
+	if (!source.has(capability_scanline))
+		return false;
+	bool in_vertical_blank = false;
+	uint scanline = source.read_scanline(in_vertical_blank);
+	publish_scanline(timepoint, scanline);
+	if (source.after_scanline)
+		source.after_scanline(scanline, in_vertical_blank);
+	return true;
+}
+
+//returns false if the source has no counter, or the read failed
+bool poll_counter(const vblank_source& source) {
+	vblank_counter_read read;
+	if (!source.has(capability_counter) || !source.read_counter(read))
+		return false;
+	publish_counter(read);
+	return true;
+}
+
+//a display that doesn't exist. its vblanks are every period ticks from origin, and its wakeups are late by lateness, exponentially distributed, like a real heartbeat's.
+//the scanline and the counter are exact, so the estimators' errors against it are theirs alone. the demo still renders to the real display, so the tearline wanders, unless the periods happen to match.
+namespace synthetic_display {
+double period = 0; //ticks. 0 = the claimed refresh rate, at the first read
+double lateness = 20e-6; //seconds, the average
+uint64_t origin = 0;
+uint64_t random_state = 0x9e3779b97f4a7c15; //only the heartbeat thread uses it
+std::once_flag started;
+
+//at the first read, from whichever thread makes it. the claimed refresh rate isn't known before main() runs
+void start() {
+	std::call_once(started, [] {
+		if (period == 0)
+			period = ticks_per_sec / system_claimed_monitor_Hz;
+		origin = now();
+	});
+}
+
+double random_unit() { //xorshift64*, in (0, 1]
+	random_state ^= random_state >> 12;
+	random_state ^= random_state << 25;
+	random_state ^= random_state >> 27;
+	return double((random_state * 0x2545f4914f6cdd1dull) >> 11 | 1) / double(uint64_t(1) << 53);
+}
+
+int64_t frame_at(uint64_t time) { return int64_t(std::floor(double(int64_t(time - origin)) / period)); }
+uint64_t vblank_of(int64_t frame) { return origin + uint64_t(std::llround(frame * period)); }
+
+bool wait_for_vblank() {
+	start();
+	uint64_t vblank = vblank_of(frame_at(now()) + 1);
+	accurate_sleep_until(vblank + uint64_t(-std::log(random_unit()) * lateness * ticks_per_sec));
+	return false;
+}
+
+uint read_scanline(bool&) {
+	start();
+	uint64_t time = now();
+	double position = double(int64_t(time - vblank_of(frame_at(time)))) / period;
+	return std::min(uint(position * total_scanlines), uint(total_scanlines - 1));
+}
+
+bool read_counter(vblank_counter_read& read) {
+	start();
+	read.count = frame_at(now());
+	read.timestamp = vblank_of(read.count);
+	return true;
+}
+
+bool registered = register_vblank_source({.name = "synthetic", .capabilities = capability_heartbeat | capability_scanline | capability_counter, .simulated = true, .wait_for_vblank = wait_for_vblank, .read_scanline = read_scanline, .read_counter = read_counter});
+} // namespace synthetic_display
@@ -38,8 +38,10 @@ we can draw a period/phase line, which goes through all its vblank points. it sa
 	at least two timepoints must land on the period/phase line
 that means it must be one of the lines on this lower convex hull, since that is the definition of lines on the lower convex hull.
 the line on the lower convex hull that crosses the middle (where middle = average frame #) is the one that specifies the optimal period/phase pair. any other line on the lower convex hull can be pivoted around one of its points, reducing error each time, until it reaches this middle line.
+	the same holds if each timepoint's distance is weighted: the middle is then the weighted average frame. the hull doesn't change, only where it's cut. see set_recency_half_life()
 
 detailed strategy: we maintain a cache of points on the convex hull. this is sparse and easy to keep updated
+it's kept in pieces, one per block of the window, so that adding and expiring points never has to walk the hull. the pieces are stitched together with binary searches.
 when a new timepoint is added, the middle timepoint may no longer be between the two pivot points. if so, we find two points on the convex hull that do surround it.
 since we always know the two pivot points, we know the period/phase pair, and we are done.
 
@@ -61,8 +63,9 @@ to trigger clock skew problems with a rigid algorithm requires special circumsta
 asymptotes:
 phase error = 1/size
 period error = 1/size^2
-runtime average time = log(size), maybe.
-runtime max time = size. the convex hull would need to be fully browsed. which is possible: if time is accelerating, then every point is on the convex hull.
+runtime average time = log(size)^2
+runtime max time = log(size)^2. it used to be size: the convex hull would need to be fully browsed, which is possible if time is accelerating, since then every point is on the convex hull.
+	now, the hull is stored in blocks, and every operation is a binary search, so nothing is ever browsed. see hull_block.
 */
 
 /*
@@ -70,11 +73,12 @@ below is documentation for myself, not for others.
 
 etc/vsync slow.cpp contains some logic and math, but I think most of it is obsolete now
 
-future: implement frame shift
+frame shift is implemented, in recover_with_frame_shift(). see "I came back" below.
 
 future: implement error adjustment, either average, truncated average or order statistic
 	conclusions from testing: order statistic is probably better. however, I see no good way to implement order statistics without being O(n). even a tree won't work, because the errors change as the pivots change
 	average should be smoothed. it would add in excess error if it was subtracted directly, as it varies too much.
+	done: it's the nonlinear lowpass in phase_error_filter, which replaced the order statistic.
 
 future: check the error of the last 4 or so points only. if they are bad, then reset. this will detect monitor changes? nah, no point, just call the reset manually.
 
@@ -112,17 +116,29 @@ how would we maintain our convex hull invariant?
 		and, check if it becomes a pivot point
 	if it moves up or down, don't just assume it gains/loses the obvious convex hull/pivot point status. you still have to check.
 	and, you have to run find_convex_line_backwards_from() on the moved point itself, too.
+what I ended up doing: rebuild_block() rebuilds the hulls of the moved point's block. it's O(size log size), but it only runs on anomalies, never in the normal path.
+	the candidates tested are the pivots moved up, the point with the highest error moved down, and the newest point in either direction. the one which lowers the error the most wins.
+	zero frames: if the previous point was a multiframe, it was probably a late wakeup that got pushed into the next frame. so it's moved back a frame, instead of pushing the new point forward.
+	long multiframes (alt-tab): if the new point lands on the extrapolated line, the window is kept. only a point which doesn't fit causes a restart.
+	too many multiframes: if the line still fits the points tightly, and the frame gaps don't share a common factor, they're just skipped vblanks. the window is kept.
 */
 
 #include "console.h"
 #include "div_floor.h"
+#include "period_drift.h"
 #include "timing.h"
-#include <algorithm> //nth_element
+#include "vblank_estimate.h"
+#include "vsync_events.cpp"
+#include "vsync_pll.cpp"
+#include <algorithm>
 #include <array>
 #include <atomic>
 #include <cmath>
+#include <bit> //countr_zero
+#include <numeric> //gcd
+#include <span>
+#include <type_traits>
 
-#define phase_error_adjustment_order_statistic false
 //goal: reach the accurate phase error, and also reduce wobble.
 //turns out adjusting for phase error with an order statistic actually degrades wobble.
 //that means, we need a lowpass filter on the phase error.
@@ -130,452 +146,1372 @@ how would we maintain our convex hull invariant?
 //if the value is above the current lowpass, it goes up by a constant fixed amount. this prevents runaway frames from causing issues.
 //if the value is below the current lowpass, it gets averaged in.
 //it's a nonlinear filter just like our order statistics
+//the order statistic was an nth_element over the whole window, with a modulo per point, every vblank. this is O(1) per timepoint: each new timepoint's distance above the line is one sample.
+//what it corrects: the line rides on the earliest timepoints, but those are still late. so the line is later than the true vblank.
+//in simulation with exponentially distributed lateness, the line is late by 2 * (average lateness) / (size - 2), from 8 to 512 points. the lowpass settles near the average lateness, so that's the correction.
+//	at 32 points, it takes the phase from 0.059 of the average lateness late, to 0.001 early. it's also unaffected by 3% of timepoints being 30x late.
+//	with a lognormal lateness, the bias is only cut by a third, since the early tail is thinner. that's what the multiplier is for.
+//	at 4 points, the new timepoint is a pivot so often that the lowpass sinks to 0, and it does nothing. it starts working at 8.
+//	the lowpass is smooth, so the wobble (jitter between successive phases) doesn't change at all.
+struct phase_error_filter {
+	bool enabled = true;
+	double rise = 0.01; //if a timepoint is above the lowpass, the lowpass goes up by this proportion of itself
+	double fall = 0.01; //if a timepoint is below the lowpass, it's averaged in with this weight
+	double multiplier = 2.0; //phase error = multiplier * lowpass / (elements - 2)
+	double lowpass = 0; //ticks. it describes the system's wakeups, not the window, so it's kept through restarts
+
+	//distance: how far the new timepoint is above the line. average_error: used to start the lowpass, since a proportional rise can't leave 0
+	void add(double distance, double average_error) {
+		if (lowpass <= 0)
+			lowpass = average_error;
+		if (distance > lowpass)
+			lowpass += lowpass * rise;
+		else
+			lowpass += (distance - lowpass) * fall;
+	}
 
-namespace vf {
-std::atomic_uint64_t vblank_phase_atomic = 0; //can't use atomic frame_clock::time_point because compiler complains that it's not trivially copyable
-//not sure if it must be initialized with 0, to prevent loading an undefined value. I am not familiar with the flow here
-//it must be a uint64_t, not a double, because this is a circular clock. but the period can be a double, which marginally improves rounding accuracy.
-std::atomic<double> vblank_period_atomic = ticks_per_sec / 60.0;
+	double phase_error(double elements) {
+		if (!enabled || elements <= 2)
+			return 0;
+		return multiplier * lowpass / (elements - 2);
+	}
+};
+
+//feeds a recorded trace through a finder, a vsync_hypotheses, or a vsync_cascade, all in one call.
+//live, every timepoint publishes through the seqlock and may print. a replay of hours of timepoints wants neither, so both are off until the end, when the final estimate is published once.
+//trajectory receives the estimate after each timepoint. it can be empty if you only want the end result. after a rejected timepoint, the previous estimate repeats: compare generation to tell.
+//if the finder was already replaying, it stays that way, and nothing is published: the caller's replay publishes when it ends.
+template <typename estimator>
+void replay_timepoints(estimator& finder, std::span<const uint64_t> timepoints, std::span<vblank_estimate> trajectory) {
+	check(trajectory.empty() || trajectory.size() >= timepoints.size(), "trajectory is too short", trajectory.size(), timepoints.size());
+	bool was_replaying = finder.replaying;
+	finder.set_replaying(true);
+	for (size_t x = 0; x < timepoints.size(); ++x) {
+		finder.new_value(timepoints[x]);
+		if (!trajectory.empty())
+			trajectory[x] = finder.latest;
+	}
+	finder.set_replaying(was_replaying);
+	if (!was_replaying)
+		finder.estimate.store(finder.latest);
+}
 
-//how many timepoints to store in the circular buffer
-constexpr uint max_size = 32; //4 or more. power of 2. (if =2, you only have 1 point when transitioning to a new value, so the pivot fails)
+//how many timepoints to store in the circular buffer: max_size. 4 or more. power of 2. (if =2, you only have 1 point when transitioning to a new value, so the pivot fails)
 //256-sized finder takes 0.004 ms when calm. occasional spikes upward, up to 0.2 ms.
+//	that was with the old hull, which could walk every point. with the blocked hull, a synthetic test on a desktop takes 0.0004 ms at 32 and 0.0006 ms at 512. when every point is on the hull, 0.0016 ms at 512.
+//	calm is slower than the old hull, which was usually done in 1 or 2 steps. but there are no more spikes, except on frame shifts, which rebuild one block.
 //the finder should take at most half the time it creates through improved accuracy. it's on a different thread, but we should still be nice with CPU.
 //the error in the wakeup is 0.09 ms / size(). at 16 timepoints, the error in prediction is already reduced to the time spent
-//there's also a consideration: the fewer points there are, the later it will be. a consistent bias that is hard to adjust for.
+//there's also a consideration: the fewer points there are, the later it will be. a consistent bias that is hard to adjust for. phase_error_filter adjusts for most of it.
 //at 32 points, it takes 0.002 ms when calm. occasional spikes upward, up to 0.015 ms. expected error is 0.003 ms, which is 0.2 frames at 1080.
 
-namespace circular {
-uint64_t timepoints[max_size]; //circular buffer
-unsigned frame_of[max_size] = {}; //stores our guesses on which frame each timepoint belongs to. initialize to zero to avoid UB, since when adding the first point, its frame is 1 + previous frame.
-//future: perhaps allow multiple timepoints in one frame, if we are to use D3DKMTGetScanLine.
-//we disallow it for now. there is only one check to take care of, in new_value(). in the future, if we operate frame shifts, we might have more checks. though, that would probably require a completely different algorithm.
-//for example, D3DKMTGetScanLine probably wants you to do a least-squares optimization, not this pivoting
-bool multiframe[max_size] = {}; //whether this timepoint is 2 frames or more after its previous timepoint. maybe it's not efficient to store bools, but it's semantically a bool
-
-//invariant: if you take the line given by a point and the convex hull point before it, then every previous point in the circular buffer lies above that line.
-//this array is characterized by that invariant: for each input position, this contains the position of the convex hull point before it.
-unsigned previous_point_on_convex_hull[max_size] = {};
-
-//for each point on the convex hull, this stores the next point. for points off the convex hull, this contains junk.
-//thus, next_point_on_convex_hull only contains a valid value if the input came from previous_point_on_convex_hull, and hence is a convex hull point. i.e. next(previous(x)) is valid, but previous(next(x)) is not valid.
-unsigned next_point_on_convex_hull[max_size] = {};
-} // namespace circular
-uint index_end = 0; //the elements inside the circular buffer are at [index_begin % max_size, index_end % max_size). these are floating indices
-uint index_begin = 0;
-uint middle_pivot = 0; //lies in [midpoint, index_end). the midpoint has the average frame number.
-//the two pivots of the line are convex_at(middle_pivot) and middle_pivot. so middle_pivot is actually the right pivot.
-//pivot[0] < midpoint, pivot[1] >= midpoint
-//occasionally, if middle_pivot lies exactly on the midpoint, then it's unclear whether the line should aim at the pivot before or the pivot after
-//if this happens (which is rare, since max_size is even), then we'll do an "average of two pivots" special case when calculating the periods
-
-uint sum_of_all_frames = 0; //we use this to find the midpoint timepoint, by taking an average
-uint64_t sum_of_all_timepoints = 0; //we use this to find the error (timepoints minus frame baseline timepoints)
-uint number_of_multiframes = 0; //each timepoint counts only once, no matter how many frames it skips. this best reflects its power - single exceptional jumps should only count as one, and if there are many large jumps, it doesn't matter whether you count them as 1 or many, they will cause a reset either way.
-
-uint64_t period_numerator, period_denominator; //find_period_ratio() calculates these. they're kept between frames (but become stale until find_period_ratio() is run again)
-//period ~ period_numerator/period_denominator. we store it in fractional form so we can do integer arithmetic without rounding.
-
-uint64_t& timepoint_at(uint x) { return circular::timepoints[x % max_size]; } //modulo operation is automatically converted to & (max_size - 1)
-uint& frame_at(uint x) { return circular::frame_of[x % max_size]; }
-bool& multiframe_at(uint x) { return circular::multiframe[x % max_size]; }
-uint& convex_at(uint x) { return circular::previous_point_on_convex_hull[x % max_size]; }
-uint& convex_next(uint x) { return circular::next_point_on_convex_hull[x % max_size]; }
-uint elements() { return index_end - index_begin; }
-
-//return (t0 - t_base) / (d0 - d_base) <= (t1 - t_base) / (d1 - d_base)
-bool ratio_lteq(uint64_t t0, uint64_t t1, uint64_t t_base, uint d0, uint d1, uint d_base) {
-	//return n0 / f0 <= n1 / f1;
-	int64_t n0 = t0 - t_base;
-	int64_t n1 = t1 - t_base;
-	int f0 = d0 - d_base;
-	int f1 = d1 - d_base;
-	return int64_t(n0 * f1 - n1 * f0) <= 0;
-}
+//all state lives inside the object, so you can run as many finders as you want side by side: one per display, or a long and a short one fed the same timepoints.
+template <uint max_size>
+struct vsync_finder {
+	static_assert(max_size >= 4 && (max_size & (max_size - 1)) == 0, "max_size must be a power of 2, at least 4");
+
+	seqlock<vblank_estimate> estimate; //the renderer reads this. phase, period, and quality arrive together, never a new phase with an old period.
+	uint64_t estimates_published = 0;
+	vblank_estimate latest; //the last estimate, on the writer's side. estimate holds the same, except during a replay
+	bool replaying = false; //no debug output, and nothing is published. see replay_timepoints()
+	vsync_event_source source = source_vf; //tags this finder's events in vsync_events
+	bool reporting = true; //vsync_hypotheses turns this off for all but the best hypothesis, whose events are the real ones
+	phase_error_filter phase_filter; //on by default. set phase_filter.enabled = false to publish the raw line
+	period_drift_filter drift_filter; //fed by full windows. like phase_filter, it describes the system, so it's kept through restarts. set drift_filter.enabled = false to publish without drift
+
+	struct {
+		uint64_t timepoints[max_size]; //circular buffer
+		unsigned frame_of[max_size] = {}; //stores our guesses on which frame each timepoint belongs to. initialize to zero to avoid UB, since when adding the first point, its frame is 1 + previous frame.
+		//future: perhaps allow multiple timepoints in one frame, if we are to use D3DKMTGetScanLine.
+		//we disallow it for now. there is only one check to take care of, in new_value(). in the future, if we operate frame shifts, we might have more checks. though, that would probably require a completely different algorithm.
+		//for example, D3DKMTGetScanLine probably wants you to do a least-squares optimization, not this pivoting
+		bool multiframe[max_size] = {}; //whether this timepoint is 2 frames or more after its previous timepoint. maybe it's not efficient to store bools, but it's semantically a bool
+
+		//the window is cut into blocks of block_size points, aligned on the floating indices. it touches at most 3 blocks: the front one, whose points are expiring, a full middle one, and the back one, which is filling.
+		//each block keeps its lower convex hull in two forms, in the block's own slots. the slots don't collide, since blocks 2 apart never use the same form at the same time.
+		//prefix_hull: hull of the block's points from its start, left to right. new points are added on the right.
+		//suffix_hull: hull of the block's points up to its end, as a stack with the leftmost point on top. it's built right to left, one point per new timepoint, while the block is in the middle.
+		//	when the block reaches the front, its points expire in the reverse order they were pushed, so each expiration just undoes a push.
+		//every change is a binary search plus O(1) writes. nothing ever walks the hull, so there are no spikes when time is accelerating.
+		unsigned prefix_hull[max_size] = {};
+		unsigned suffix_hull[max_size] = {};
+		//a push onto the suffix hull truncates the stack and overwrites one slot. this stores what it destroyed, per pushed point, so that the push can be undone.
+		unsigned suffix_overwritten[max_size] = {};
+		unsigned suffix_size_before[max_size] = {};
+	} circular;
+
+	//the window keeps at most window_size points. it's a power of 2 between min_window and max_size, and it changes at runtime, see tune_window().
+	//the blocks are always half a window, so the hull's costs and its readiness rules don't depend on the window size.
+	uint window_size = max_size;
+	uint block_size = max_size / 2;
+	uint block_shift = std::countr_zero(max_size / 2); //log2(block_size)
+	struct hull_block {
+		uint prefix_size;
+		uint suffix_size;
+		uint suffix_begin; //the suffix hull covers the block's points in [suffix_begin, end of block). floating index
+	};
+	hull_block hull_blocks[4] = {}; //3 are in use. 4 so that the modulo is still consistent when the floating indices wrap around
+	uint index_end = 0; //the elements inside the circular buffer are at [index_begin % max_size, index_end % max_size). these are floating indices
+	uint index_begin = 0;
+	uint middle_pivot = 0; //lies in [midpoint, index_end). the midpoint has the average frame number.
+	uint pivot_before = 0; //the convex hull point before middle_pivot
+	uint pivot_after = 0; //the convex hull point after middle_pivot. junk if middle_pivot is the newest point
+	//the two pivots of the line are pivot_before and middle_pivot. so middle_pivot is actually the right pivot.
+	//pivot[0] < midpoint, pivot[1] >= midpoint
+	//occasionally, if middle_pivot lies exactly on the midpoint, then it's unclear whether the line should aim at the pivot before or the pivot after
+	//if this happens (which is rare, since max_size is even), then we'll do an "average of two pivots" special case when calculating the periods
+
+	uint sum_of_all_frames = 0; //we use this to find the midpoint timepoint, by taking an average
+	uint64_t sum_of_all_timepoints = 0; //we use this to find the error (timepoints minus frame baseline timepoints)
+
+	//recency weights. with drift, the timepoints lie on a parabola, and the old end of the window drags the line away from the present. the fewer points, the less drag, but the later and noisier the line.
+	//weighting the timepoints' distances by how recent they are does the same thing without throwing points away: the weight halves every recency_half_life frames.
+	//	the line is still a hull line through two pivots, since the weighted error is still linear in the period between two hull points. the weighted average frame is later than the plain one, so the pivots sit later in the window.
+	//	the weights are geometric in the frame number, so all three sums decay by one multiply when a timepoint arrives, and an expiring point subtracts its own weight. O(1), like sum_of_all_frames.
+	//	the hull still holds the whole window, so the frame guesses, the error checks and the multiframe rules still see every point. only the line leans toward the recent ones.
+	//the phase filter's correction is sized by the effective number of points, (sum w)^2 / sum w^2, since a line that leans on fewer points is later.
+	//simulated at 59.94 Hz, 256 points, a fixed window, wakeups 1 ms into the porch plus 20 us exponential, 5% of vblanks skipped. phase rms of the next vblank, with half-lives of none / 256 / 128 / 64 / 32 frames:
+	//	no drift: 0.30 / 0.30 / 0.33 / 0.43 / 0.73 us. 1 ppm/s: 0.62 / 0.56 / 0.51 / 0.50 / 0.74 us. 5 ppm/s: 1.8 / 1.6 / 1.4 / 1.0 / 0.87 us.
+	//	a plain window of 128 points: 0.60 / 0.62 / 0.96 us, and 64 points: 1.2 us at every drift. so weights buy the same drift tracking for less noise than a shorter window.
+	//	the weighted lines are 0.1-0.2 us later on average, the phase filter doesn't quite cover them. 3% of wakeups 30x late don't change any of this.
+	double recency_half_life = 0; //frames. 0 = every point counts the same, which is the plain hull
+	double recency = 1; //the weight of a point relative to one a frame newer
+	uint weights_frame = 0; //the ages are counted from this frame, the newest point's
+	double weight_sum = 0;
+	double weighted_age_sum = 0; //sum of weight * (weights_frame - frame)
+	double squared_weight_sum = 0;
+	uint rejected_in_a_row = 0; //timepoints thrown away after a long gap, because they didn't fit the line
+	uint cadence = 1; //vblanks per timepoint, when every gap in the window is a multiple of it. see explain_multiframes()
+	uint number_of_multiframes = 0; //each timepoint counts only once, no matter how many frames it skips. this best reflects its power - single exceptional jumps should only count as one, and if there are many large jumps, it doesn't matter whether you count them as 1 or many, they will cause a reset either way.
+
+	uint64_t period_numerator, period_denominator; //find_period_ratio() calculates these. they're kept between frames (but become stale until find_period_ratio() is run again)
+	//period ~ period_numerator/period_denominator. we store it in fractional form so we can do integer arithmetic without rounding.
+
+	//most restarts come from alt-tab or sleep, not from a mode change. so the last period we trusted survives restarts, and counts the frames between the first few new timepoints.
+	//with only 2-3 points, the window's own period is a guess: a skipped vblank doubles it. the prior knows better.
+	//it's thrown away as soon as the new timepoints disagree with it.
+	uint64_t prior_numerator = 0, prior_denominator = 0; //denominator 0 = no prior
+	static constexpr uint trusted_elements = max_size < 8 ? max_size : 8; //a published period from this many points becomes the prior. below this many points, the prior counts frames
+	static constexpr uint max_prior_gap = 16; //the prior's period error adds up over the gap. past this many frames, the window's usual rules decide
+
+	//the nominal period, from the modeline. a line whose period is outside the band around it has a wrong frame guess somewhere, so it's rejected like excess error.
+	//until there's a trusted prior, it also counts the frames between the first timepoints.
+	//it replaces a debug check that the period was between 50 and 70 Hz, which was wrong for 144/240/360 Hz panels.
+	double nominal_low = 0, nominal_high = 0; //ticks. 0 = no nominal period
+	uint64_t nominal_numerator = 0, nominal_denominator = 0; //the nominal period as a ratio, for frames_by_prior()
+	uint band_restarts_in_a_row = 0;
+	static constexpr uint max_band_restarts = 16; //if the band rejects this many windows in a row, the mode changed and the nominal period is stale. so it's dropped
+
+	//call before feeding timepoints. tolerance is relative: 0.01 = 1%
+	void set_nominal_period(double period, double tolerance) {
+		nominal_low = period * (1 - tolerance);
+		nominal_high = period * (1 + tolerance);
+		nominal_denominator = 1024;
+		nominal_numerator = std::llround(period * nominal_denominator);
+		band_restarts_in_a_row = 0;
+	}
 
-//<=. only used to verify correctness (so you can ignore this)
-bool period_index_lteq(uint i0, uint i1, uint index_base) {
-	//return n0 / f0 <= n1 / f1;
-	int64_t n0 = timepoint_at(i0) - timepoint_at(index_base);
-	int64_t n1 = timepoint_at(i1) - timepoint_at(index_base);
-	int f0 = frame_at(i0) - frame_at(index_base);
-	int f1 = frame_at(i1) - frame_at(index_base);
-	//outc(n0, n1, f0, f1);
-	return int64_t(n0 * f1 - n1 * f0) <= 0;
-}
+	void set_replaying(bool on) { replaying = on; }
+	void new_values(std::span<const uint64_t> timepoints, std::span<vblank_estimate> trajectory = {}) { replay_timepoints(*this, timepoints, trajectory); }
+
+	//call from the thread that feeds timepoints, or before it starts. the hull doesn't depend on the weights, so the window is kept, and only the pivots move
+	void set_recency_half_life(double frames) {
+		recency_half_life = frames;
+		recency = frames > 0 ? std::exp2(-1 / frames) : 1;
+		recompute_weights();
+		if (elements() >= 2) {
+			find_pivots();
+			find_period_ratio();
+		}
+	}
 
-bool before(uint a, uint b) {
-	return (int)(a - b) < 0;
-}
+	bool period_in_band() {
+		if (nominal_high == 0)
+			return true;
+		double period = double(period_numerator) / period_denominator;
+		return period >= nominal_low && period <= nominal_high;
+	}
 
-//checks that the cached invariants are correct.
-void reference_verify_correctness() {
-	uint frame_sum = 0;
-	uint64_t timepoint_sum = 0;
-	uint multiframes = 0;
-	for (uint x = index_begin; x != index_end; ++x) {
-		frame_sum += frame_at(x);
-		timepoint_sum += timepoint_at(x);
-		multiframes += multiframe_at(x);
-	}
-	check(frame_sum == sum_of_all_frames, frame_sum, sum_of_all_frames);
-	check(timepoint_sum == sum_of_all_timepoints, "timepoint mismatch", timepoint_sum, sum_of_all_timepoints);
-	check(multiframes == number_of_multiframes, "multiframe mismatch", multiframes, number_of_multiframes);
-	if (middle_pivot != index_end - 1) //most recent element has no convex_next possible
-		check(convex_at(convex_next(middle_pivot)) == middle_pivot);
-	uint pivot[2] = {convex_at(middle_pivot), middle_pivot};
-	check(before(frame_at(pivot[0]) * elements(), sum_of_all_frames)); //first pivot is before the midpoint
-	check(!before(frame_at(pivot[1]) * elements(), sum_of_all_frames)); //second pivot is after the midpoint
-	for (uint index = index_begin; index < index_end; ++index) {
-		if (before(sum_of_all_frames, frame_at(index) * elements())) //divide points into before the midpoint and after the midpoint
-			check(period_index_lteq(pivot[1], index, pivot[0])); //points after the midpoint give a period at least as long as the second pivot. this means they're above the line.
+	//the arithmetic is exact integer arithmetic, so it must not overflow. that needs bounds on the window, which new_value() enforces by restarting:
+	//a window spans less than max_span_ticks (18 minutes of nanosecond ticks) and less than max_span_frames. period_denominator is then < max_span_frames^2.
+	static constexpr uint64_t max_span_ticks = uint64_t(1) << 40;
+	static constexpr uint max_span_frames = max_size * 8; //skipping 7 of every 8 vblanks is still a window. it's a power of 2
+	static constexpr int span_tick_bits = 40;
+	static constexpr int span_frame_bits = std::countr_zero(max_span_frames);
+	//the hull compares ticks * frames. that fits in 64 bits for any window we'll ever use.
+	using hull_int = std::conditional_t<span_tick_bits + span_frame_bits + 1 <= 63, int64_t, int128>;
+	//the line's arithmetic goes up to period_denominator * elements() * ticks, in the frame guess and the error sum. at 32 points that's 61 bits; at 64 it doesn't fit.
+	//so small finders stay in 64 bits, and large ones pay for 128-bit multiplies and one 128-bit division per timepoint.
+	using wide = std::conditional_t<span_frame_bits * 2 + std::countr_zero(max_size) + span_tick_bits <= 63, int64_t, int128>;
+	static double to_double(wide x) {
+		if constexpr (std::is_same_v<wide, int64_t>)
+			return double(x);
 		else
-			check(period_index_lteq(index, pivot[0], pivot[1])); //points before the midpoint give a period at least as short as the first pivot. this means they're above the line.
+			return double(int64_t(x >> 32)) * 4294967296.0 + double(uint32_t(x)); //MSVC's int128 doesn't convert to double
 	}
-}
-#define debug_outc_vsync(...) outc(__VA_ARGS__)
+
+	uint64_t& timepoint_at(uint x) { return circular.timepoints[x % max_size]; } //modulo operation is automatically converted to & (max_size - 1)
+	uint& frame_at(uint x) { return circular.frame_of[x % max_size]; }
+	bool& multiframe_at(uint x) { return circular.multiframe[x % max_size]; }
+	uint elements() { return index_end - index_begin; }
+	hull_block& block_of(uint x) { return hull_blocks[x >> block_shift & 3]; }
+	uint block_start(uint x) { return x & ~(block_size - 1); }
+
+	//return (t0 - t_base) / (d0 - d_base) <= (t1 - t_base) / (d1 - d_base)
+	static bool ratio_lteq(uint64_t t0, uint64_t t1, uint64_t t_base, uint d0, uint d1, uint d_base) {
+		//return n0 / f0 <= n1 / f1;
+		int64_t n0 = t0 - t_base;
+		int64_t n1 = t1 - t_base;
+		int f0 = d0 - d_base;
+		int f1 = d1 - d_base;
+		return hull_int(n0) * f1 - hull_int(n1) * f0 <= 0;
+	}
+
+	//<=. only used to verify correctness (so you can ignore this)
+	bool period_index_lteq(uint i0, uint i1, uint index_base) {
+		//return n0 / f0 <= n1 / f1;
+		int64_t n0 = timepoint_at(i0) - timepoint_at(index_base);
+		int64_t n1 = timepoint_at(i1) - timepoint_at(index_base);
+		int f0 = frame_at(i0) - frame_at(index_base);
+		int f1 = frame_at(i1) - frame_at(index_base);
+		//outc(n0, n1, f0, f1);
+		return hull_int(n0) * f1 - hull_int(n1) * f0 <= 0;
+	}
+
+	static bool before(uint a, uint b) {
+		return (int)(a - b) < 0;
+	}
+
+	bool weighted() { return recency_half_life > 0; }
+	double age_of(uint position) { return double(weights_frame - frame_at(position)); }
+
+	//O(size). runs when frames change inside the window, which only happens on anomalies
+	void recompute_weights() {
+		weight_sum = weighted_age_sum = squared_weight_sum = 0;
+		if (!weighted() || elements() == 0)
+			return;
+		weights_frame = frame_at(index_end - 1);
+		for (uint x = index_begin; x != index_end; ++x) {
+			double weight = std::pow(recency, age_of(x));
+			weight_sum += weight;
+			weighted_age_sum += weight * age_of(x);
+			squared_weight_sum += weight * weight;
+		}
+	}
+
+	//the newest point was just placed at index_end - 1. everything else gets a frame older
+	void weigh_newest() {
+		if (!weighted())
+			return;
+		double frames = int(frame_at(index_end - 1) - weights_frame);
+		double decay = std::pow(recency, frames);
+		weighted_age_sum = decay * (weighted_age_sum + frames * weight_sum);
+		weight_sum = decay * weight_sum + 1;
+		squared_weight_sum = decay * decay * squared_weight_sum + 1;
+		weights_frame = frame_at(index_end - 1);
+	}
+
+	//the oldest point is about to expire
+	void unweigh_oldest() {
+		if (!weighted())
+			return;
+		double age = age_of(index_begin);
+		double weight = std::pow(recency, age);
+		weight_sum -= weight;
+		weighted_age_sum = std::max(weighted_age_sum - weight * age, 0.0); //the newest point has age 0, so this only guards against rounding
+		squared_weight_sum -= weight * weight;
+	}
+
+	//whether a point's frame is at or past the (weighted) average frame
+	bool at_or_after_midpoint(uint position) {
+		if (!weighted())
+			return !before(frame_at(position) * elements(), sum_of_all_frames);
+		return age_of(position) * weight_sum <= weighted_age_sum;
+	}
+
+	//the weighted midpoint is practically never exactly on a frame, so it has no special case
+	bool on_midpoint(uint position) { return !weighted() && frame_at(position) * elements() == sum_of_all_frames; }
+
+	//for phase_filter. the plain hull's is elements()
+	double effective_elements() { return weighted() ? weight_sum * weight_sum / squared_weight_sum : elements(); }
+
+	//checks that the cached invariants are correct.
+	void reference_verify_correctness() {
+		uint frame_sum = 0;
+		uint64_t timepoint_sum = 0;
+		uint multiframes = 0;
+		for (uint x = index_begin; x != index_end; ++x) {
+			frame_sum += frame_at(x);
+			timepoint_sum += timepoint_at(x);
+			multiframes += multiframe_at(x);
+		}
+		check(frame_sum == sum_of_all_frames, frame_sum, sum_of_all_frames);
+		check(timepoint_sum == sum_of_all_timepoints, "timepoint mismatch", timepoint_sum, sum_of_all_timepoints);
+		check(multiframes == number_of_multiframes, "multiframe mismatch", multiframes, number_of_multiframes);
+		if (weighted()) {
+			double weights = 0;
+			for (uint x = index_begin; x != index_end; ++x)
+				weights += std::pow(recency, age_of(x));
+			check(std::abs(weights - weight_sum) <= 1e-9 * weights, "weight mismatch", weights, weight_sum);
+		}
+		if (elements() == window_size) //the front block is expiring
+			check(block_of(index_begin).suffix_begin == index_begin, "suffix hull isn't ready", block_of(index_begin).suffix_begin, index_begin);
+		if (middle_pivot != index_end - 1) //most recent element has no point after it
+			check(before(middle_pivot, pivot_after));
+		uint pivot[2] = {pivot_before, middle_pivot};
+		check(!at_or_after_midpoint(pivot[0])); //first pivot is before the midpoint
+		check(at_or_after_midpoint(pivot[1])); //second pivot is after the midpoint
+		for (uint index = index_begin; index < index_end; ++index) {
+			if (at_or_after_midpoint(index) && !on_midpoint(index)) //divide points into before the midpoint and after the midpoint
+				check(period_index_lteq(pivot[1], index, pivot[0])); //points after the midpoint give a period at least as long as the second pivot. this means they're above the line.
+			else
+				check(period_index_lteq(index, pivot[0], pivot[1])); //points before the midpoint give a period at least as short as the first pivot. this means they're above the line.
+		}
+	}
+#define debug_outc_vsync(...) \
+	do { \
+		if (!replaying) \
+			outc(__VA_ARGS__); \
+	} while (0)
 //#define debug_outc_vsync(...) ;
 
-//goal: set convex_at(position)
-//summary: check points of the convex hull, moving backward. each pair of convex hull points gives a line, where both points of the line are behind the parameter position.
-//if the line is below the parameter position, that's success. every line behind will also be below the parameter position. convex_at(position) = second point of the line
-//if the line is above the parameter position, connect the parameter position with the first point of the line, and continue searching
-void find_convex_line_backwards_from(uint position) {
-	convex_at(position) = position - 1;
-	for (uint hull_iterator = position - 1;; hull_iterator = convex_at(hull_iterator)) {
-		//the line to test is (convex_at(hull_iterator), hull_iterator).
-		//if convex_at(hull_iterator) fell off the back end, we must recalculate it to be able to test the line
-		if (before(convex_at(hull_iterator), index_begin)) {
-			if (hull_iterator == index_begin) {
-				convex_at(position) = index_begin;
-				return;
-			}
+	//pushes an event into vsync_events, with the window as it is right now. it's a handful of stores, so it's cheap enough for the vsync thread
+	void report(vsync_event_reason reason, uint64_t timepoint) {
+		if (replaying || !reporting)
+			return;
+		bool has_line = elements() >= 2;
+		push_vsync_event({timepoint, reason, source, elements(), has_line ? double(period_numerator) / period_denominator : 0, average_error()});
+	}
+
+	//true if b lies on or above the line through a and c. a, b, c must be in frame order.
+	//on the line counts as above, so collinear points are dropped from the hull. that makes the hull as short as possible.
+	bool above_line(uint a, uint b, uint c) {
+		return ratio_lteq(timepoint_at(c), timepoint_at(b), timepoint_at(a), frame_at(c), frame_at(b), frame_at(a));
+	}
+
+	//the first x in [low, high) where predicate(x) is true, or high if there is none. predicate must be false, then true.
+	template <typename Predicate>
+	static uint first_true(uint low, uint high, Predicate predicate) {
+		while (low < high) {
+			uint middle = low + (high - low) / 2;
+			if (predicate(middle))
+				high = middle;
 			else
-				find_convex_line_backwards_from(hull_iterator);
+				low = middle + 1;
+		}
+		return low;
+	}
+
+	//a convex chain, read left to right, made of up to 3 pieces of hull arrays.
+	//the hull of the whole window is never written out, since that would be O(size). instead, hulls are joined by cutting pieces, which is O(1).
+	struct hull_chain {
+		struct piece {
+			const unsigned* hull;
+			uint first; //floating index of the piece's first slot
+			uint size;
+			bool reversed; //suffix hulls are stacks with the leftmost point on top, so they're read backward
+			uint at(uint i) const { return hull[(reversed ? first + size - 1 - i : first + i) % max_size]; }
+		};
+		piece pieces[3];
+		uint count = 0;
+
+		uint size() const {
+			uint total = 0;
+			for (uint p = 0; p < count; ++p)
+				total += pieces[p].size;
+			return total;
+		}
+		uint at(uint i) const {
+			for (uint p = 0;; ++p) {
+				if (i < pieces[p].size)
+					return pieces[p].at(i);
+				i -= pieces[p].size;
+			}
+		}
+		//appends the points [low, high) of another chain
+		void append(const hull_chain& other, uint low, uint high) {
+			for (uint p = 0; p < other.count; ++p) {
+				piece cut = other.pieces[p];
+				uint cut_low = std::min(low, cut.size);
+				uint cut_high = std::min(high, cut.size);
+				low -= cut_low;
+				high -= cut_high;
+				if (cut_low == cut_high)
+					continue;
+				cut.first += cut.reversed ? cut.size - cut_high : cut_low;
+				cut.size = cut_high - cut_low;
+				check(count < 3, "too many hull pieces");
+				pieces[count++] = cut;
+			}
 		}
+	};
+
+	hull_chain prefix_chain(uint start) { return {{{circular.prefix_hull, start, block_of(start).prefix_size, false}}, 1}; }
+	hull_chain suffix_chain(uint start) { return {{{circular.suffix_hull, start, block_of(start).suffix_size, true}}, 1}; }
+
+	//adds a point on the right of its block's prefix hull.
+	//the hull points which fall above the line to the new point are a suffix of the hull, so we binary search for where they start, then cut them off.
+	void hull_push_back(uint position) {
+		uint start = block_start(position);
+		hull_block& block = block_of(position);
+		auto hull_at = [&](uint i) { return circular.prefix_hull[(start + i) % max_size]; };
+		uint size = block.prefix_size;
+		if (size >= 2)
+			size = first_true(0, size - 1, [&](uint i) { return above_line(hull_at(i), hull_at(i + 1), position); }) + 1;
+		circular.prefix_hull[(start + size) % max_size] = position;
+		block.prefix_size = size + 1;
+	}
 
-		uint hull_point_before = convex_at(hull_iterator);
+	//adds a point on the left of its block's suffix hull. same as hull_push_back(), but mirrored, and it remembers what it overwrote.
+	void hull_push_front(uint position) {
+		uint start = block_start(position);
+		hull_block& block = block_of(position);
+		auto hull_at = [&](uint i) { return circular.suffix_hull[(start + i) % max_size]; };
+		uint size = block.suffix_size;
+		if (size >= 2)
+			size = first_true(1, size, [&](uint i) { return above_line(position, hull_at(i), hull_at(i - 1)); });
+		circular.suffix_overwritten[position % max_size] = hull_at(size);
+		circular.suffix_size_before[position % max_size] = block.suffix_size;
+		circular.suffix_hull[(start + size) % max_size] = position;
+		block.suffix_size = size + 1;
+		block.suffix_begin = position;
+	}
 
-		//checks if the implied period between position and hull_point_before is smaller than the implied period between hull_iterator and hull_point_before.
-		//if true, then position is below the line.
-		//<= is better than <. faster bailout.
-		//if it's <, then if we have equally spaced timepoints, then every single convex_at() points at the rearmost element.
-		//then, when it expires, they all point to an invalid element. so you trace all the way back, then trace all the way forward.
-		//if it's <=, then every convex_at() points to the element just behind. you bail out immediately.
-		bool point_below_line = ratio_lteq(timepoint_at(position), timepoint_at(hull_iterator), timepoint_at(hull_point_before), frame_at(position), frame_at(hull_iterator), frame_at(hull_point_before));
-		if (point_below_line)
-			convex_at(position) = hull_point_before;
-		else
-			return;
+	//removes the oldest point. its block must be at the front, so the point is on top of the suffix hull's undo history.
+	void hull_pop_front(uint position) {
+		uint start = block_start(position);
+		hull_block& block = block_of(position);
+		check(block.suffix_begin == position, "suffix hull isn't ready", block.suffix_begin, position);
+		circular.suffix_hull[(start + block.suffix_size - 1) % max_size] = circular.suffix_overwritten[position % max_size];
+		block.suffix_size = circular.suffix_size_before[position % max_size];
+		block.suffix_begin = position + 1;
 	}
-}
 
-//note it's unsigned 64-bit only. don't pass it signed things!
-//0.5 rounds down. (? looks to me like it rounds up? why did I write that it rounds down?)
-uint64_t rounded_divide(uint64_t n, uint64_t d) {
-	return (n + d / 2) / d;
-}
+	//a new point was placed at index_end - 1.
+	void add_to_hull(uint position) {
+		if (block_start(position) == position)
+			block_of(position) = {0, 0, position + block_size};
+		hull_push_back(position);
+		//the previous block will be at the front once it starts expiring. build its suffix hull one point per new timepoint, so it's ready by then.
+		//it has at most block_size points to build, and block_size new timepoints to build them in.
+		uint previous_start = block_start(position) - block_size;
+		if (before(index_begin, previous_start + block_size)) {
+			uint lowest = before(index_begin, previous_start) ? previous_start : index_begin;
+			hull_block& previous = block_of(previous_start);
+			if (previous.suffix_begin != lowest)
+				hull_push_front(previous.suffix_begin - 1);
+		}
+	}
 
-void find_period_ratio() {
-	//the period is in an integer ratio. we don't want to divide the ratio yet, because that would introduce a rounding inaccuracy.
-	//hence, we store the numerator and denominator.
+	//the lower common tangent of two convex chains, where every point of left is before every point of right. returns the hull of both together.
+	//for a point on left, the tangent to right is a binary search. then whether that tangent is also a tangent of left is another binary search. O(log^2)
+	hull_chain bridge(const hull_chain& left, const hull_chain& right) {
+		uint left_size = left.size();
+		uint right_size = right.size();
+		auto tangent_from = [&](uint point) {
+			return first_true(0, right_size - 1, [&](uint j) { return !above_line(point, right.at(j), right.at(j + 1)); });
+		};
+		uint i = first_true(0, left_size - 1, [&](uint i) { return above_line(left.at(i), left.at(i + 1), right.at(tangent_from(left.at(i)))); });
+		uint j = tangent_from(left.at(i));
+		hull_chain joined;
+		joined.append(left, 0, i + 1);
+		joined.append(right, j, right_size);
+		return joined;
+	}
 
-	uint multiple_at_this_frame = frame_at(middle_pivot) * elements();
+	//the hull of the whole window, pieced together from its blocks. then the pivots are the hull points surrounding the midpoint.
+	void find_pivots() {
+		uint front = block_start(index_begin);
+		bool front_is_back = !before(front + block_size, index_end);
+		hull_chain hull = !front_is_back && block_of(front).suffix_begin == index_begin ? suffix_chain(front) : prefix_chain(front); //right after a restart, the front block's suffix hull isn't built yet, but its prefix hull still starts at index_begin
+		for (uint start = front + block_size; before(start, index_end); start += block_size)
+			hull = bridge(hull, prefix_chain(start));
+
+		//the first hull point can never be past the midpoint, and the last hull point can never be before it.
+		uint size = hull.size();
+		uint pivot = first_true(1, size - 1, [&](uint k) { return at_or_after_midpoint(hull.at(k)); });
+		pivot_before = hull.at(pivot - 1);
+		middle_pivot = hull.at(pivot);
+		pivot_after = pivot + 1 < size ? hull.at(pivot + 1) : middle_pivot;
+	}
 
-	//it's before the midpoint. moving forward once might not fix it completely. we repeat it until it's at the midpoint or past it
-	while (before(multiple_at_this_frame, sum_of_all_frames)) {
-		middle_pivot = convex_next(middle_pivot);
-		multiple_at_this_frame = frame_at(middle_pivot) * elements();
+	//rebuilds one block's hulls from scratch, after a frame inside it has changed. this is O(block_size log block_size), but it only runs on anomalies, never in the normal path.
+	//each hull is rebuilt only as far as it had been built before, so the other blocks don't notice anything.
+	void rebuild_block(uint start) {
+		uint first = before(index_begin, start) ? start : index_begin;
+		uint last = before(start + block_size, index_end) ? start + block_size : index_end;
+		hull_block& block = block_of(start);
+		uint suffix_begin = block.suffix_begin;
+		block = {0, 0, start + block_size};
+		if (before(index_end - 1, start + 2 * block_size)) //once the back block is 2 blocks ahead, the prefix hull's slots belong to it
+			for (uint x = first; x != last; ++x)
+				hull_push_back(x);
+		for (uint x = start + block_size; x != suffix_begin;)
+			hull_push_front(--x);
 	}
 
-	if (multiple_at_this_frame == sum_of_all_frames) {
-		//it's exactly at the midpoint. we should take an average of before and after
-		//t0/f0 + t1/f1 = (t0f1 + t1f0)/(f0f1)
-		//this improves integer division accuracy, but beware that it might cause overflow
-		uint pivot_before = convex_at(middle_pivot);
-		uint pivot_after = convex_next(middle_pivot);
-		uint64_t t0 = timepoint_at(middle_pivot) - timepoint_at(pivot_before);
-		uint64_t t1 = timepoint_at(pivot_after) - timepoint_at(middle_pivot);
-		uint64_t f0 = frame_at(middle_pivot) - frame_at(pivot_before);
-		uint64_t f1 = frame_at(pivot_after) - frame_at(middle_pivot);
-		period_numerator = t0 * f1 + t1 * f0;
-		period_denominator = f0 * f1 * 2;
+	//rebuilds every block's hulls from scratch, after the block size changed. O(window_size log window_size), but the window rarely changes size.
+	//the front block's suffix hull is built down to index_begin, since its points are the next to expire. the middle block gets both hulls, so it's ready long before it reaches the front.
+	//the back block only has its prefix hull, and add_to_hull() takes care of it from here, as usual.
+	void rebuild_hulls() {
+		uint front = block_start(index_begin);
+		uint back = block_start(index_end - 1);
+		for (uint start = front;; start += block_size) {
+			uint first = before(index_begin, start) ? start : index_begin;
+			uint last = before(start + block_size, index_end) ? start + block_size : index_end;
+			block_of(start) = {0, 0, start + block_size};
+			if (start == back || start != front)
+				for (uint x = first; x != last; ++x)
+					hull_push_back(x);
+			if (start != back)
+				for (uint x = last; x != first;)
+					hull_push_front(--x);
+			if (start == back)
+				break;
+		}
+		recompute_weights();
+		find_pivots();
 	}
-	else {
-		uint pivot_before = convex_at(middle_pivot);
-		uint64_t t0 = timepoint_at(middle_pivot) - timepoint_at(pivot_before);
-		uint64_t f0 = frame_at(middle_pivot) - frame_at(pivot_before);
 
-		period_numerator = t0;
-		period_denominator = f0;
+	void update_multiframe(uint position) {
+		if (position == index_begin || position == index_end)
+			return; //the oldest point's gap is to a point which has already expired. leave it alone
+		number_of_multiframes -= multiframe_at(position);
+		multiframe_at(position) = int(frame_at(position) - frame_at(position - 1)) >= 2;
+		number_of_multiframes += multiframe_at(position);
 	}
-	check(period_denominator != 0);
-}
 
-void set_period_phase();
+	//frames must stay strictly increasing: each timepoint has its own vblank
+	bool can_shift_frame(uint position, int direction) {
+		uint new_frame = frame_at(position) + direction;
+		if (position != index_begin && int(new_frame - frame_at(position - 1)) <= 0)
+			return false;
+		if (position != index_end - 1 && int(frame_at(position + 1) - new_frame) <= 0)
+			return false;
+		return true;
+	}
 
-double calc_error_in_shitty_way() { //throws away rounding information, and rounds improperly. oh well!
-	//this is accurate.
-	uint64_t error_from_baseline_times_period_denominator = period_denominator * (sum_of_all_timepoints - timepoint_at(middle_pivot) * elements()) - int(sum_of_all_frames - frame_at(middle_pivot) * elements()) * period_numerator;
-	//this is not accurate. I could use rounded_divide(), but who cares
-	uint64_t average_error_in_ticks = error_from_baseline_times_period_denominator / (elements() - 2) / period_denominator;
+	//moves one timepoint to a neighboring frame. direction -1 moves it up in the plot (its vblank is earlier, so it's further from it), +1 moves it down.
+	void shift_frame(uint position, int direction) {
+		frame_at(position) += direction;
+		sum_of_all_frames += direction;
+		update_multiframe(position);
+		update_multiframe(position + 1);
+		rebuild_block(block_start(position));
+		recompute_weights();
+		find_pivots();
+	}
 
-	return average_error_in_ticks;
-}
+	//run find_period_ratio() first
+	bool excess_error() {
+		//if error >= period / 4
+		//2 elements don't participate in error calculation because they are pivot points and have their error artificially zeroed. that's why we use (elements() - 2) instead of elements().
+		return error_from_baseline_times_period_denominator() >= wide(elements() - 2) * wide(period_numerator) / 4;
+	}
 
-void restart(uint64_t new_timepoint) {
-	index_begin = index_end - 1;
-	timepoint_at(index_begin) = new_timepoint;
-	frame_at(index_begin) = 0;
-	//convex_at(index_begin) = index_begin - 1; //don't need this, it's set when there are two elements
-	//middle_pivot = index_begin; //don't need this, it's set when there are two elements
-	sum_of_all_frames = 0;
-	sum_of_all_timepoints = new_timepoint;
-	number_of_multiframes = 0;
-	debug_outc_vsync("restarting vsync"); //this is a bad sign
-}
+	double average_error() {
+		return elements() > 2 ? to_double(error_from_baseline_times_period_denominator()) / ((elements() - 2) * period_denominator) : 0;
+	}
+
+	//signed distance of a point from the line, times period_denominator. run find_period_ratio() first
+	wide residual_times_period_denominator(uint64_t timepoint, uint frame) {
+		return wide(int64_t(timepoint - timepoint_at(middle_pivot))) * wide(period_denominator) - wide(int(frame - frame_at(middle_pivot))) * wide(period_numerator);
+	}
+
+	//instead of throwing the window away when the error is too high, try to find the timepoint whose frame was guessed wrong, and move it.
+	//each attempt tests one local change at a time, and keeps the one with the lowest error. returns true if the error is acceptable again, and the period is inside the nominal band.
+	bool recover_with_frame_shift() {
+		for (uint attempt = 0; attempt < 2; ++attempt) {
+			uint worst = index_begin;
+			wide worst_residual = 0;
+			for (uint x = index_begin; x != index_end; ++x) {
+				wide residual = residual_times_period_denominator(timepoint_at(x), frame_at(x));
+				if (residual > worst_residual) {
+					worst_residual = residual;
+					worst = x;
+				}
+			}
+			//a late wakeup that got pushed into the next frame lands early, and drags the line under itself as a pivot. it wants to move up.
+			//an early wakeup that got the previous frame has a huge error. it wants to move down.
+			std::pair<uint, int> candidates[] = {{pivot_before, -1}, {middle_pivot, -1}, {worst, 1}, {index_end - 1, -1}, {index_end - 1, 1}};
+			double best_error = period_in_band() ? average_error() : INFINITY; //a line outside the nominal band loses to anything inside it
+			std::pair<uint, int> best = {0, 0};
+			for (auto [position, direction] : candidates) {
+				if (!can_shift_frame(position, direction))
+					continue;
+				shift_frame(position, direction);
+				find_period_ratio();
+				if (period_in_band() && average_error() < best_error) {
+					best_error = average_error();
+					best = {position, direction};
+				}
+				shift_frame(position, -direction);
+			}
+			if (best.second == 0) {
+				find_period_ratio();
+				return false;
+			}
+			shift_frame(best.first, best.second);
+			find_period_ratio();
+			report(event_frame_shift, timepoint_at(index_end - 1));
+			debug_outc_vsync("frame shift", int(best.first - index_begin), best.second, "error", best_error / ticks_per_sec * 1000, "ms, size", elements());
+			if (!excess_error() && period_in_band())
+				return true;
+		}
+		return false;
+	}
+
+	//the rational multiples of the line's period that a wrong frame guess can produce: period * first / second.
+	//the line's period can be too short (1.5x, 4/3x, 2x the true one is the real period), or too long, if the platform only delivers every other vblank and the nominal period says so.
+	//	a shorter period is only tried with a nominal period. without one, every window fits half its period too: each point still gets its own vblank on a lattice twice as fine.
+	//	so a loose line from a few late wakeups would be halved, and the cadence rule would double it back a few points later.
+	static constexpr uint harmonics[][2] = {{2, 1}, {3, 2}, {4, 3}, {1, 2}};
+
+	//whether the window fits a lattice of vblanks with period numerator / denominator, through middle_pivot: each timepoint gets its own vblank, and the average distance to the vblanks is under 1/8 period.
+	//it's O(size), so it only runs on anomalies.
+	bool fits_period(uint64_t numerator, uint64_t denominator) {
+		double period = double(numerator) / denominator;
+		if (nominal_high != 0 && (period < nominal_low || period > nominal_high))
+			return false;
+		double distance = 0;
+		int64_t first_frame = 0, previous_frame = 0;
+		for (uint x = index_begin; x != index_end; ++x) {
+			double position = double(int64_t(timepoint_at(x) - timepoint_at(middle_pivot))) / period;
+			int64_t frame = std::llround(position);
+			distance += std::abs(position - double(frame));
+			if (x == index_begin)
+				first_frame = frame;
+			else if (frame <= previous_frame)
+				return false;
+			previous_frame = frame;
+		}
+		return previous_frame - first_frame < max_span_frames - 1 && distance * 8 < elements();
+	}
+
+	//re-guesses every frame in the window with the period numerator / denominator, then rebuilds the hulls and the line. run fits_period() first.
+	void reframe(uint64_t numerator, uint64_t denominator) {
+		double period = double(numerator) / denominator;
+		uint base = frame_at(middle_pivot);
+		uint64_t base_timepoint = timepoint_at(middle_pivot);
+		sum_of_all_frames = 0;
+		number_of_multiframes = 0;
+		for (uint x = index_begin; x != index_end; ++x) {
+			frame_at(x) = base + uint(std::llround(double(int64_t(timepoint_at(x) - base_timepoint)) / period));
+			sum_of_all_frames += frame_at(x);
+			multiframe_at(x) = x != index_begin && int(frame_at(x) - frame_at(x - 1)) >= 2; //the oldest point's gap is to a point which has already expired
+			number_of_multiframes += multiframe_at(x);
+		}
+		rebuild_hulls();
+		find_period_ratio();
+	}
+
+	//when the line doesn't explain the window, one of its rational multiples might. then the frames were guessed with the wrong period, and the window is kept with the right one.
+	//returns true if the window was reframed, and the new line passes the error and band checks.
+	//a young window is cheap to throw away, and a few points fit some multiple by chance, so it's only tried on a window that has earned it.
+	bool reframe_to_harmonic(uint64_t new_timepoint) {
+		if (elements() < trusted_elements)
+			return false;
+		for (auto [multiplier, divisor] : harmonics) {
+			if (multiplier < divisor && nominal_high == 0)
+				continue;
+			if (!fits_period(period_numerator * multiplier, period_denominator * divisor))
+				continue;
+			report(event_reframed, new_timepoint);
+			debug_outc_vsync("reframed at", multiplier, "/", divisor, "of the period, size", elements());
+			reframe(period_numerator * multiplier, period_denominator * divisor);
+			cadence = 1;
+			return !excess_error() && period_in_band();
+		}
+		return false;
+	}
+
+	//the multiframe rule: when a third of the timepoints skip vblanks, the line's period might be 1.5x or 4/3x too short. it used to just restart.
+	//multiframes which are just skipped vblanks fit the line tightly, while a wrong period leaves errors of 1/4 period or more. so a tight line is kept.
+	//if every gap shares a factor, the timepoints come at a cadence: a compositor that only delivers every other vblank makes every timepoint a multiframe.
+	//	the line's period is then either the display's, with a cadence of 2, or a divisor of the true one. the nominal period tells them apart, since the band only admits the display's.
+	//	without a nominal period, a cadence can't be told from a mode change, so the window is reframed at the delivered period, with a cadence of 1.
+	//a loose line is given a chance with the rational multiples of its period, before the window is thrown away.
+	bool explain_multiframes(uint64_t new_timepoint) {
+		if (average_error() * 8 >= double(period_numerator) / period_denominator)
+			return reframe_to_harmonic(new_timepoint);
+		uint common_gap = 0;
+		for (uint x = index_begin + 1; x != index_end; ++x)
+			common_gap = std::gcd(common_gap, frame_at(x) - frame_at(x - 1));
+		if (common_gap <= 1 || nominal_high != 0) {
+			cadence = std::max(common_gap, 1u);
+			return true;
+		}
+		if (!fits_period(period_numerator * common_gap, period_denominator))
+			return false;
+		report(event_reframed, new_timepoint);
+		debug_outc_vsync("reframed at the cadence", common_gap, "size", elements());
+		reframe(period_numerator * common_gap, period_denominator);
+		cadence = 1;
+		return !excess_error();
+	}
+
+	//note it's unsigned 64-bit only. don't pass it signed things!
+	//0.5 rounds down. (? looks to me like it rounds up? why did I write that it rounds down?)
+	static uint64_t rounded_divide(uint64_t n, uint64_t d) {
+		return (n + d / 2) / d;
+	}
+
+	void find_period_ratio() {
+		//the period is in an integer ratio. we don't want to divide the ratio yet, because that would introduce a rounding inaccuracy.
+		//hence, we store the numerator and denominator.
+
+		//find_pivots() already put middle_pivot at the midpoint or past it
+		if (on_midpoint(middle_pivot)) {
+			//it's exactly at the midpoint. we should take an average of before and after
+			//t0/f0 + t1/f1 = (t0f1 + t1f0)/(f0f1)
+			//this improves integer division accuracy, but beware that it might cause overflow
+			uint64_t t0 = timepoint_at(middle_pivot) - timepoint_at(pivot_before);
+			uint64_t t1 = timepoint_at(pivot_after) - timepoint_at(middle_pivot);
+			uint64_t f0 = frame_at(middle_pivot) - frame_at(pivot_before);
+			uint64_t f1 = frame_at(pivot_after) - frame_at(middle_pivot);
+			period_numerator = t0 * f1 + t1 * f0;
+			period_denominator = f0 * f1 * 2;
+		}
+		else {
+			uint64_t t0 = timepoint_at(middle_pivot) - timepoint_at(pivot_before);
+			uint64_t f0 = frame_at(middle_pivot) - frame_at(pivot_before);
+
+			period_numerator = t0;
+			period_denominator = f0;
+		}
+		check(period_denominator != 0);
+	}
+
+	//sum of (timepoint - its frame's vblank) over all timepoints, times period_denominator. exact.
+	//the sums wrap around, but their differences are small: under elements() * max_span_ticks.
+	wide error_from_baseline_times_period_denominator() {
+		return wide(period_denominator) * wide(int64_t(sum_of_all_timepoints - timepoint_at(middle_pivot) * elements())) - wide(int(sum_of_all_frames - frame_at(middle_pivot) * elements())) * wide(period_numerator);
+	}
+
+	double calc_error_in_shitty_way() { //throws away rounding information, and rounds improperly. oh well!
+		wide error_from_baseline_times_period_denominator = this->error_from_baseline_times_period_denominator();
+		//this is not accurate. I could use rounded_divide(), but who cares
+		uint64_t average_error_in_ticks = uint64_t(error_from_baseline_times_period_denominator / wide(elements() - 2) / wide(period_denominator));
+
+		return average_error_in_ticks;
+	}
+
+	//frames from the previous timepoint to the new one, counted with the prior period, or the nominal period if there's no prior yet. 0 if neither can say.
+	//if the gap isn't close to a whole number of periods, the prior is wrong (the mode changed), so it's discarded.
+	uint frames_by_prior(uint64_t new_timepoint) {
+		bool from_nominal = prior_denominator == 0;
+		uint64_t numerator = from_nominal ? nominal_numerator : prior_numerator;
+		uint64_t denominator = from_nominal ? nominal_denominator : prior_denominator;
+		if (denominator == 0 || elements() == 0 || elements() >= trusted_elements)
+			return 0;
+		uint64_t gap = new_timepoint - timepoint_at(index_end - 1);
+		if (gap / (numerator / denominator) >= max_prior_gap)
+			return 0;
+		uint64_t frames = rounded_divide(gap * denominator, numerator);
+		int64_t residual = int64_t(gap * denominator - frames * numerator);
+		if (frames == 0 || std::abs(residual) * 4 >= int64_t(numerator)) {
+			report(event_prior_contradicted, new_timepoint);
+			debug_outc_vsync(from_nominal ? "nominal period contradicted" : "period prior contradicted", double(gap) * denominator / numerator, "frames, size", elements());
+			prior_denominator = 0; //the nominal period isn't dropped here. a single late timepoint can do this, and the band decides whether the nominal period is stale
+			return 0;
+		}
+		return uint(frames);
+	}
+
+	//a young window leans on the prior. if it falls apart, the prior is the likely culprit
+	void restart_young_window(uint64_t new_timepoint) {
+		if (elements() <= trusted_elements)
+			prior_denominator = 0;
+		restart(new_timepoint);
+	}
+
+	void restart_out_of_band(uint64_t new_timepoint) {
+		report(event_out_of_band, new_timepoint);
+		debug_outc_vsync("period out of band", double(period_numerator) / period_denominator / ticks_per_sec * 1000, "ms, nominal", nominal_low / ticks_per_sec * 1000, nominal_high / ticks_per_sec * 1000, "size", elements());
+		if (++band_restarts_in_a_row >= max_band_restarts) {
+			report(event_nominal_dropped, new_timepoint);
+			debug_outc_vsync("nominal period keeps disagreeing, dropping it");
+			nominal_low = nominal_high = 0;
+			nominal_denominator = 0;
+		}
+		restart_young_window(new_timepoint);
+	}
 
-void new_value(uint64_t new_timepoint) {
-	//technically, you could cause UB if the buffer contained timepoints 2^31 frames apart, causing division by 0.
-	//however, that takes 172 days on a 144 Hz monitor. so we don't care.
+	//the best window length depends on the machine. a long window averages out more noise, but when the period drifts (clock skew, a GPU changing clocks), its old points drag the line.
+	//so the window grows while new timepoints keep landing where the line says they would, and shrinks when they walk away from it.
+	//each new timepoint's residual is measured against the line before it joins. with noise alone, it averages to about the average lateness.
+	//	drift makes it average higher if the period is growing, and lower, even negative, if it's shrinking. so a lowpass of the residuals that strays far from the lateness means the line is behind.
+	//the average error can't be the yardstick, since drift bends the whole window away from the line and inflates it too. but drift is smooth, so it cancels out of the difference between successive residuals.
+	//	for exponential lateness, the average difference is exactly the average lateness. so that's the yardstick. for half-normal and lognormal lateness, the lowpass settles at 1.1-1.2 instead of 1, which is still far from the threshold.
+	//each residual is capped, so that a single very late wakeup can't shrink the window.
+	//in simulation at 256 points with 0.05 ms exponential lateness: a steady period keeps the full window, with the same phase error. a period that steps by 0.3% every 5000 vblanks goes from 0.045 ms phase error to 0.003 ms.
+	//	a slow sinusoidal drift of 0.3% goes from 0.072 ms to 0.019 ms. a fixed window of 32 does better there (0.005 ms), but it's 9x worse on a steady period.
+	bool self_tuning = true;
+	static constexpr uint min_window = max_size < 16 ? max_size : 16;
+	static constexpr double drift_cap = 3; //in units of the lateness. at 4, 10% of timepoints being very late pushed the lowpass up far enough to shrink the window now and then
+	static constexpr double drift_rate = 1.0 / 16;
+	static constexpr double lateness_rate = 1.0 / 64;
+	static constexpr double drift_threshold = 0.75; //the window shrinks if the lowpass strays this far from 1. it only grows if it's within half of this
+	double drift_lowpass = 1; //in units of the lateness
+	double lateness = 0; //ticks. lowpass of the differences between successive residuals. it describes the system's wakeups, so it's kept through restarts
+	double previous_residual = 0;
+	uint stable_timepoints = 0; //since the window last changed size, or since drift was last seen. the window grows after window_size of them
+
+	void resize_window(uint new_size) {
+		report(event_window_resized, timepoint_at(index_end - 1));
+		debug_outc_vsync(new_size > window_size ? "window grows to" : "window shrinks to", new_size, "error", average_error() / ticks_per_sec * 1000, "ms, drift", drift_lowpass);
+		while (elements() > new_size) { //shrinking throws away the oldest points
+			sum_of_all_frames -= frame_at(index_begin);
+			sum_of_all_timepoints -= timepoint_at(index_begin);
+			number_of_multiframes -= multiframe_at(index_begin);
+			++index_begin;
+		}
+		window_size = new_size;
+		block_size = new_size / 2;
+		block_shift = std::countr_zero(block_size);
+		rebuild_hulls();
+		find_period_ratio();
+		stable_timepoints = 0;
+		drift_lowpass = 1;
+	}
+
+	//residual is the new timepoint's distance from the line before it joined, in ticks. runs once the timepoint is in the window.
+	void tune_window(double residual) {
+		if (!self_tuning)
+			return;
+		double difference = std::abs(residual - previous_residual);
+		previous_residual = residual;
+		if (lateness <= 0)
+			lateness = average_error();
+		if (lateness <= 0)
+			return;
+		lateness += (std::min(difference, drift_cap * lateness) - lateness) * lateness_rate;
+		double sample = std::clamp(residual / lateness, -drift_cap, drift_cap);
+		drift_lowpass += (sample - drift_lowpass) * drift_rate;
+		++stable_timepoints;
+		if (elements() < window_size) //still filling. the line is young, and it's not the window size's fault
+			return;
+		double drift = std::abs(drift_lowpass - 1);
+		if (drift > drift_threshold) {
+			if (window_size > min_window)
+				resize_window(window_size / 2);
+			stable_timepoints = 0;
+		}
+		else if (stable_timepoints >= window_size && drift < drift_threshold / 2 && window_size < max_size)
+			resize_window(window_size * 2);
+	}
+
+	void restart(uint64_t new_timepoint) {
+		report(event_restart, new_timepoint); //before anything is reset, so the event describes the window that failed
+		index_begin = index_end - 1;
+		timepoint_at(index_begin) = new_timepoint;
+		frame_at(index_begin) = 0;
+		multiframe_at(index_begin) = 0; //number_of_multiframes is reset, so the flag must be too
+		block_of(index_begin) = {0, 0, block_start(index_begin) + block_size};
+		hull_push_back(index_begin);
+		//middle_pivot = index_begin; //don't need this, it's set when there are two elements
+		sum_of_all_frames = 0;
+		sum_of_all_timepoints = new_timepoint;
+		number_of_multiframes = 0;
+		cadence = 1;
+		rejected_in_a_row = 0;
+		drift_lowpass = 1;
+		stable_timepoints = 0; //the window keeps its size. it describes the machine, not the window that failed
+		recompute_weights();
+		debug_outc_vsync("restarting vsync"); //this is a bad sign
+	}
+
+	//the frame the line puts a new timepoint in. it captures [-1/n, (n-1)/n) of a period after the frame's vblank. needs 2 elements
+	uint line_frame(uint64_t new_timepoint) {
+		return uint(div_floor(wide(period_denominator) * wide(elements()) * wide(int64_t(new_timepoint - timepoint_at(middle_pivot))) + wide(period_numerator), wide(period_numerator) * wide(elements()))) + frame_at(middle_pivot);
+	}
 
-	//debug_outc_vsync("starting", index_begin, "pivot", convex_at(middle_pivot), middle_pivot, "elements", index_end - index_begin, "frames", "sums", sum_of_all_frames, frame_at(convex_at(middle_pivot)) * (index_end - index_begin), frame_at(middle_pivot) * (index_end - index_begin));
-	uint previous_element = index_end - 1;
-	if (elements() >= 1) check(new_timepoint != timepoint_at(previous_element)); //this is a really degenerate case, and we don't want to handle it.
-	if (elements() <= 1) { //special cases when there are too few elements, so we may not have enough information to reliably estimate the frame of the new timepoint
+	//whether a new timepoint lands so close to the edge of its frame that it could belong to the neighboring frame. returns the direction of that frame, or 0 if the guess is clear.
+	//right after a restart, the prior counts frames, so there's no ambiguity to speak of.
+	//ambiguity is the width of the edges, in units of 1/elements() periods.
+	int ambiguous_direction(uint64_t new_timepoint, double ambiguity) {
+		if (elements() < trusted_elements || new_timepoint - timepoint_at(index_begin) >= max_span_ticks)
+			return 0;
+		double position = to_double(residual_times_period_denominator(new_timepoint, line_frame(new_timepoint))) / period_numerator; //in periods, after the frame's vblank
+		if (position >= 1 - (1 + ambiguity) / elements())
+			return 1; //a very late wakeup, or an early wakeup for the next frame
+		if (position < (ambiguity - 1) / elements())
+			return -1; //an early wakeup, or a very late wakeup for the previous frame
+		return 0;
+	}
+
+	//sum of the distances of the timepoints from the line, each capped at cap. ticks. O(size), so it's only for comparing hypotheses.
+	//the plain error sum can't tell a very late wakeup from a wrong frame guess: the late point costs its whole lateness, and the wrong guess costs about the same, spread over every point as the line tilts.
+	//capped, the late point costs only the cap, while the tilt costs every point.
+	double capped_error(double cap) {
+		double sum = 0;
+		for (uint x = index_begin; x != index_end; ++x)
+			sum += std::min(to_double(residual_times_period_denominator(timepoint_at(x), frame_at(x))) / period_denominator, cap);
+		return sum;
+	}
+
+	//frame_offset moves the new timepoint away from the frame the finder would guess. it's how vsync_hypotheses tests the other guess. it's ignored for the first 2 timepoints
+	void new_value(uint64_t new_timepoint, int frame_offset = 0) {
+		//technically, you could cause UB if the buffer contained timepoints 2^31 frames apart, causing division by 0.
+		//however, that takes 172 days on a 144 Hz monitor. so we don't care.
+
+		//debug_outc_vsync("starting", index_begin, "pivot", pivot_before, middle_pivot, "elements", index_end - index_begin, "frames", "sums", sum_of_all_frames, frame_at(pivot_before) * (index_end - index_begin), frame_at(middle_pivot) * (index_end - index_begin));
+		uint previous_element = index_end - 1;
+		if (elements() >= 1) check(new_timepoint != timepoint_at(previous_element)); //this is a really degenerate case, and we don't want to handle it.
+		if (elements() >= 1 && new_timepoint - timepoint_at(index_begin) >= max_span_ticks) { //also catches a clock that went backwards
+			report(event_window_too_long, new_timepoint);
+			debug_outc_vsync("window too long", double(new_timepoint - timepoint_at(index_begin)) / ticks_per_sec, "s");
+			restart(new_timepoint);
+			return;
+		}
+		if (elements() <= 1) { //special cases when there are too few elements, so we may not have enough information to reliably estimate the frame of the new timepoint
+			uint frames = frames_by_prior(new_timepoint);
+			timepoint_at(index_end) = new_timepoint;
+			frame_at(index_end) = frame_at(previous_element) + (frames ? frames : 1); //without a prior, assume the next frame
+			multiframe_at(index_end) = frames >= 2;
+			sum_of_all_timepoints += timepoint_at(index_end);
+			sum_of_all_frames += frame_at(index_end);
+			number_of_multiframes += multiframe_at(index_end); //does nothing without a prior (it's 0)
+			add_to_hull(index_end);
+			++index_end;
+			weigh_newest();
+			if (elements() == 2) {
+				find_pivots();
+				find_period_ratio();
+				if (!period_in_band()) { //probably a late first timepoint. the new one is a better start
+					restart_out_of_band(new_timepoint);
+					return;
+				}
+				set_period_phase();
+			}
+			//if there's one point, don't bother setting the phase. it's probably junk info anyway.
+			return;
+		}
+
+		//estimate the frame of the new timepoint
+		uint this_frame = line_frame(new_timepoint);
+		//(new timepoint - middle timepoint + period/size) / period + middle frame
+		//a timepoint can be snapped into a frame even if it lands before that frame.
+		//so if there are n timepoints, a frame should capture approximately [-1/n, (n-1)/n).
+		//note that the phase error of the period/phase pair ~ 1/n. I don't know the constants though.
+		//period error ~ 1/n^2, which means period error gives another 1/n to the phase error, since it's at the end. n * 1/n^2.
+		//maybe in the future, I'll do a simulation with a uniform distribution.
+		//at low sizes, we should be much more tolerant, since the period/phase might suffer from black swan events. still, the lower bound should be at least -1/2.
+		//-1/2 can be ok. if there are 3 points, and the middle is delayed by 1/3, the timepoint differences will be 1, 4/3, 2/3. then it's -1/2. however, it would equally be valid to split this to 2 frames, then 1 frame.
+		//going from 3->4, the bound is [-1/3, 2/3). which is about right.
+		//technically, if the frame distance is higher, we should allow more tolerance, by adding the number of frames to elements() in the expression. however, we won't bother.
+		//right after a restart, the line is built from a handful of points, and the prior period is much better at counting frames.
+		uint frames_from_prior = frames_by_prior(new_timepoint);
+		if (frames_from_prior)
+			this_frame = frame_at(previous_element) + frames_from_prior;
+		this_frame += frame_offset;
+		if (this_frame - frame_at(index_begin) >= max_span_frames - 1) { //-1, since a frame shift can still push the newest timepoint a frame later
+			report(event_window_too_long, new_timepoint);
+			debug_outc_vsync("window too long", this_frame - frame_at(index_begin), "frames, size", elements());
+			restart(new_timepoint);
+			return;
+		}
+		double residual_before_joining = to_double(residual_times_period_denominator(new_timepoint, this_frame)) / period_denominator; //for tune_window()
+
+		//the average timepoint has error 0.05 ms. so timepoints with excess error should be tossed. we don't know what frame they are on, and our algorithm relies on correct frame guesses.
+		//however, we don't know if it's the new timepoint which is wrong, or our old timepoints which are wrong. so we can't just toss one unless we are really sure.
+		//I don't know that I can be bothered to separate out these timepoints. we'll just attempt to recover from errors, by testing shifting 4 points, as described in "I came back"
+
+		//D3DKMTWaitForVerticalBlankEvent has average 0.05 ms error
+		//IDirectDraw7::WaitForVerticalBlank has average 0.002 ms error. and is running up against some quantization error (0.0020526412155577067 * 2435886 ticks per sec = 5000 exactly)
+
+		//3 elements with timepoints 0, 2, 3, will cause the vsync to report a 1.5x period time.
+		//but these timepoints will be rejected no matter which period is chosen. if the frames are 1-1, it'll be rejected by error, since 1/2 > 1/4. if the frames are 2-1, it'll be rejected since 50% of the frames are multi-frames, which is greater than 1/3.
+		//it makes sense to reject these 3 timepoints and start fresh: there is barely any information, so there is no loss in throwing it away. you'll get some better information soon.
+		//so, there is also no point in handling these 3 points with a special case.
+		bool is_multiframe = false;
+
+		if (int(this_frame - frame_at(previous_element)) <= 0) { //two frames in the same period. this is not possible
+			report(event_zero_frame, new_timepoint);
+			debug_outc_vsync("zero frame", new_timepoint - timepoint_at(previous_element), "period", period_numerator * 1000 / period_denominator / ticks_per_sec, "size", elements());
+			//if the previous timepoint was a multiframe, it was probably a late wakeup which got pushed into the next frame. move it back.
+			if (elements() >= 3 && multiframe_at(previous_element) && previous_element != index_begin && can_shift_frame(previous_element, -1)) {
+				shift_frame(previous_element, -1);
+				report(event_frame_shift, new_timepoint);
+				debug_outc_vsync("frame shift on zero frame", "size", elements());
+			}
+			//otherwise, push the new frame forward.
+			if (int(this_frame - frame_at(previous_element)) <= 0)
+				this_frame = frame_at(previous_element) + 1;
+		}
+		else if (!frames_from_prior && int(this_frame - frame_at(previous_element)) >= int((elements() + 2) / 2)) { //the prior already placed it, and the gap is too short for the prior to drift
+			report(event_long_multiframe, new_timepoint);
+			debug_outc_vsync("long multi-frame", new_timepoint - timepoint_at(previous_element), "period", period_numerator * 1000 / period_denominator / ticks_per_sec, "size", elements());
+			//this is a really long multiframe, and we no longer have confidence that we know its phase accurately. so restart.
+			//technically, phase error is asymptotically 1/elements^2, so we should be fine even with a gap of elements^2 / 2. however, our frame guess has only 1/elements tolerance, so we don't want to push it too far.
+			//though, the phase may be completely scrambled, so maybe it's not worth it to add in the new timepoint. still, we need some information, so I guess we'll leave it alone.
+			//this is caused by alt-tab. it still receives vblank signals inconsistently
+			//but if the new point lands right on the extrapolated line, the phase isn't scrambled at all, and we keep the window.
+			//the line's uncertainty grows with the gap. as a rough estimate, average error * (gap / span of the window)
+			double period = double(period_numerator) / period_denominator;
+			double residual = to_double(residual_times_period_denominator(new_timepoint, this_frame)) / period_denominator;
+			double gap = this_frame - frame_at(previous_element);
+			double extrapolation_error = average_error() * (1 + gap / (frame_at(previous_element) - frame_at(index_begin)));
+			if (elements() < 4 || std::abs(residual) + extrapolation_error >= period / 8) {
+				//a healthy window is more trustworthy than one point after a long gap, which might be a late wakeup. so throw the point away instead, but only a couple of times in a row.
+				if (rejected_in_a_row < 2 && elements() >= window_size / 2 && !excess_error()) {
+					++rejected_in_a_row;
+					return;
+				}
+				restart(new_timepoint);
+				return;
+			}
+			is_multiframe = true;
+		}
+		else if (int(this_frame - frame_at(previous_element)) >= 2) {
+			//debug_outc_vsync("multi-frame", new_timepoint - timepoint_at(previous_element), "period", period_numerator * 1000 / period_denominator / ticks_per_sec, "size", elements());
+			//if it worth it to detect two multiframes in a row, and cause a restart?
+			//no: the true period might be 1.5x the reported period. then multiframes will alternate with single frames.
+			//then, the error would be 1/4 the period (it alternates 0 and 1/2). that's probably not enough to trigger error detection. so it must trigger multiframe detection
+			//if 1/3 are multiframes, the period might be 4/3 the reported period. then the error would be 1/3 the period (alternates 0 1/3 2/3). that should be large enough to trigger too-high error, which we'll set at 1/4.
+			is_multiframe = true;
+		}
+
+		//if the circular buffer is already full, we have an extra incoming element. so technically we have max_size + 1 elements to look at.
+		//however, we do not want to behave as if both the oldest element, and the new incoming element, both exist simultaneously.
+		//this is because it causes special cases, since we can't place the incoming element in the array
+		sum_of_all_frames += this_frame;
+		sum_of_all_timepoints += new_timepoint;
+		number_of_multiframes += is_multiframe;
+		if (elements() == window_size) {
+			sum_of_all_frames -= frame_at(index_begin); //the old value will be erased
+			sum_of_all_timepoints -= timepoint_at(index_begin);
+			number_of_multiframes -= multiframe_at(index_begin);
+			unweigh_oldest();
+			hull_pop_front(index_begin);
+			++index_begin;
+		}
 		timepoint_at(index_end) = new_timepoint;
-		frame_at(index_end) = frame_at(previous_element) + 1;
-		multiframe_at(index_end) = 0;
-		sum_of_all_timepoints += timepoint_at(index_end);
-		sum_of_all_frames += frame_at(index_end);
-		number_of_multiframes += multiframe_at(index_end); //here for consistency. does nothing (it's 0)
+		frame_at(index_end) = this_frame;
+		multiframe_at(index_end) = is_multiframe;
+		add_to_hull(index_end);
 		++index_end;
-		if (elements() == 2) {
-			middle_pivot = index_begin + 1;
-			convex_at(index_begin + 1) = index_begin;
-			convex_at(index_begin) = index_begin - 1;
-			set_period_phase();
-		}
-		//if there's one point, don't bother setting the phase. it's probably junk info anyway.
-		return;
-	}
-
-	//estimate the frame of the new timepoint
-	uint this_frame = div_floor(period_denominator * elements() * (new_timepoint - timepoint_at(middle_pivot)) + period_numerator, period_numerator * elements()) + frame_at(middle_pivot);
-	//(new timepoint - middle timepoint + period/size) / period + middle frame
-	//a timepoint can be snapped into a frame even if it lands before that frame.
-	//so if there are n timepoints, a frame should capture approximately [-1/n, (n-1)/n).
-	//note that the phase error of the period/phase pair ~ 1/n. I don't know the constants though.
-	//period error ~ 1/n^2, which means period error gives another 1/n to the phase error, since it's at the end. n * 1/n^2.
-	//maybe in the future, I'll do a simulation with a uniform distribution.
-	//at low sizes, we should be much more tolerant, since the period/phase might suffer from black swan events. still, the lower bound should be at least -1/2.
-	//-1/2 can be ok. if there are 3 points, and the middle is delayed by 1/3, the timepoint differences will be 1, 4/3, 2/3. then it's -1/2. however, it would equally be valid to split this to 2 frames, then 1 frame.
-	//going from 3->4, the bound is [-1/3, 2/3). which is about right.
-	//technically, if the frame distance is higher, we should allow more tolerance, by adding the number of frames to elements() in the expression. however, we won't bother.
-
-	//the average timepoint has error 0.05 ms. so timepoints with excess error should be tossed. we don't know what frame they are on, and our algorithm relies on correct frame guesses.
-	//however, we don't know if it's the new timepoint which is wrong, or our old timepoints which are wrong. so we can't just toss one unless we are really sure.
-	//I don't know that I can be bothered to separate out these timepoints. we'll just attempt to recover from errors, by testing shifting 4 points, as described in "I came back"
-
-	//D3DKMTWaitForVerticalBlankEvent has average 0.05 ms error
-	//IDirectDraw7::WaitForVerticalBlank has average 0.002 ms error. and is running up against some quantization error (0.0020526412155577067 * 2435886 ticks per sec = 5000 exactly)
-
-	//3 elements with timepoints 0, 2, 3, will cause the vsync to report a 1.5x period time.
-	//but these timepoints will be rejected no matter which period is chosen. if the frames are 1-1, it'll be rejected by error, since 1/2 > 1/4. if the frames are 2-1, it'll be rejected since 50% of the frames are multi-frames, which is greater than 1/3.
-	//it makes sense to reject these 3 timepoints and start fresh: there is barely any information, so there is no loss in throwing it away. you'll get some better information soon.
-	//so, there is also no point in handling these 3 points with a special case.
-	bool is_multiframe = false;
-
-	if (int(this_frame - frame_at(previous_element)) <= 0) { //two frames in the same period. this is not possible
-		debug_outc_vsync("zero frame", new_timepoint - timepoint_at(previous_element), "period", period_numerator * 1000 / period_denominator / ticks_per_sec, "size", elements());
-		//for now, just push the frame forward.
-		this_frame = frame_at(previous_element) + 1;
-		//future: may also consider attempting to push the previous frame back, if it was a multiframe.
-	}
-	else if (int(this_frame - frame_at(previous_element)) >= int((elements() + 2) / 2)) {
-		debug_outc_vsync("long multi-frame", new_timepoint - timepoint_at(previous_element), "period", period_numerator * 1000 / period_denominator / ticks_per_sec, "size", elements());
-		//this is a really long multiframe, and we no longer have confidence that we know its phase accurately. so restart.
-		//technically, phase error is asymptotically 1/elements^2, so we should be fine even with a gap of elements^2 / 2. however, our frame guess has only 1/elements tolerance, so we don't want to push it too far.
-		//though, the phase may be completely scrambled, so maybe it's not worth it to add in the new timepoint. still, we need some information, so I guess we'll leave it alone.
-		//this is caused by alt-tab. it still receives vblank signals inconsistently
-
-		//future: consider throwing away the new point as well? is it a good point?
-		restart(new_timepoint);
-		return;
-	}
-	else if (int(this_frame - frame_at(previous_element)) >= 2) {
-		//debug_outc_vsync("multi-frame", new_timepoint - timepoint_at(previous_element), "period", period_numerator * 1000 / period_denominator / ticks_per_sec, "size", elements());
-		//if it worth it to detect two multiframes in a row, and cause a restart?
-		//no: the true period might be 1.5x the reported period. then multiframes will alternate with single frames.
-		//then, the error would be 1/4 the period (it alternates 0 and 1/2). that's probably not enough to trigger error detection. so it must trigger multiframe detection
-		//if 1/3 are multiframes, the period might be 4/3 the reported period. then the error would be 1/3 the period (alternates 0 1/3 2/3). that should be large enough to trigger too-high error, which we'll set at 1/4.
-		is_multiframe = true;
-	}
-
-	//if the circular buffer is already full, we have an extra incoming element. so technically we have max_size + 1 elements to look at.
-	//however, we do not want to behave as if both the oldest element, and the new incoming element, both exist simultaneously.
-	//this is because it causes special cases, since we can't place the incoming element in the array
-	sum_of_all_frames += this_frame;
-	sum_of_all_timepoints += new_timepoint;
-	number_of_multiframes += is_multiframe;
-	if (index_end - index_begin == max_size) {
-		sum_of_all_frames -= frame_at(index_begin); //the old value will be erased
-		sum_of_all_timepoints -= timepoint_at(index_begin);
-		number_of_multiframes -= multiframe_at(index_begin);
-		++index_begin;
-	}
-	timepoint_at(index_end) = new_timepoint;
-	frame_at(index_end) = this_frame;
-	multiframe_at(index_end) = is_multiframe;
-	uint this_index = index_end;
-	++index_end;
-
-	if (is_multiframe) {
+		weigh_newest();
+		rejected_in_a_row = 0;
+
+		//the new point might have changed the hull, and the midpoint moves whenever a point enters or expires. so look for the pivots again
+		find_pivots();
+		find_period_ratio();
+		//check error
+		//outc("vsync error is", average_error(), "ticks", average_error() / ticks_per_sec * 1000, "ms");
+
+		//there are more than 2 elements if you arrived here, because 2 elements = early exit from function at beginning.
+		if (excess_error() || !period_in_band()) {
+			report(event_excess_error, new_timepoint);
+			debug_outc_vsync("excess error", average_error() / ticks_per_sec * 1000, "ms, period", period_numerator * 1000 / period_denominator / ticks_per_sec, "size", elements());
+			if (!recover_with_frame_shift() && !reframe_to_harmonic(new_timepoint)) {
+				if (!period_in_band())
+					restart_out_of_band(new_timepoint);
+				else
+					restart_young_window(new_timepoint);
+				return;
+			}
+		}
+
 		//this needs to prevent period = 1.5.
 		//0, 1.5, 3. 3 timepoints, 1 multiframe. (2n+1) timepoints for n multiframes. this case must be caught; it isn't caught by the error threshold.
 		//0, 1.3, 2.6, 4. 4 timepoints, 1 multiframe. (3n+1) timepoints for n multiframes. this case isn't important; it's already caught by the error threshold.
-		if (number_of_multiframes * 3 >= elements() - 1) {
+		//it's checked after the line is found, so that skipped vblanks (which fit the line) don't throw the window away. see explain_multiframes() for the rest
+		if (number_of_multiframes * 3 < elements() - 1)
+			cadence = 1;
+		else if (!explain_multiframes(new_timepoint)) {
+			report(event_multiframe_restart, new_timepoint);
 			debug_outc_vsync("multi-frame restart", new_timepoint - timepoint_at(previous_element), "period", period_numerator * 1000 / period_denominator / ticks_per_sec, "size", elements());
-			restart(new_timepoint);
+			restart_young_window(new_timepoint);
 			return;
 		}
+		tune_window(residual_before_joining);
+		phase_filter.add(to_double(residual_times_period_denominator(timepoint_at(index_end - 1), frame_at(index_end - 1))) / period_denominator, average_error());
+		set_period_phase(); //only publish once we know the line isn't junk
+#if !NDEBUG
+		reference_verify_correctness(); //todo: maybe turn this off
+#endif
+	}
+
+	//communicate the period and phase with the client renderer. run find_period_ratio() first.
+	//this introduces a rounding error from integer arithmetic. the exact ratio is published too, for anyone who wants it.
+	//to reduce rounding error, we position the phase on the frame after the latest frame.
+	void set_period_phase() {
+		//phase ~ index_end + period
+		//phase = round(index_end + period - timepoint_at(middle_pivot), period) * period + timepoint_at(middle_pivot)
+		//period = n/d
+		//phase = round(difference * d / n + 1) * n/d
+		double phase_error = phase_filter.phase_error(effective_elements());
+		wide frames_ahead = frame_at(index_end - 1) - frame_at(middle_pivot) + 1;
+		uint64_t phase = timepoint_at(middle_pivot) + uint64_t((frames_ahead * wide(period_numerator) + wide(period_denominator / 2)) / wide(period_denominator)) - std::llround(phase_error); //rounded_divide(), but wide
+		double period = double(period_numerator) / period_denominator;
+
+		//with drift, the timepoints lie on a parabola, not a line. the line is the chord between the two pivots, so its period is the period halfway between them.
+		//at the phase, half a window later, the period has changed by drift * time, and the parabola has pulled away from the chord by (curvature / 2) * (frames from one pivot) * (frames from the other).
+		if (elements() == window_size)
+			drift_filter.add(timepoint_at(pivot_before) + (timepoint_at(middle_pivot) - timepoint_at(pivot_before)) / 2, period);
+		double drift = drift_filter.drift();
+		double rate = drift * 1e-6 / ticks_per_sec; //relative change of the period per tick
+		double frames_after_pivot = double(frames_ahead);
+		double frames_after_pivot_before = double(frame_at(index_end - 1) - frame_at(pivot_before) + 1);
+		phase += std::llround(rate * period * period * frames_after_pivot * frames_after_pivot_before / 2);
+		period *= 1 + rate * period * (frames_after_pivot + frames_after_pivot_before) / 2;
+
+		latest = {phase, period, period_numerator, period_denominator, elements(), window_size, average_error(), phase_error, cadence, drift, ++estimates_published};
+		if (!replaying)
+			estimate.store(latest);
+		band_restarts_in_a_row = 0;
+		if (elements() >= trusted_elements) { //it passed the error and multiframe checks, and there are enough points that the frames weren't counted by the prior
+			prior_numerator = period_numerator;
+			prior_denominator = period_denominator;
+		}
+	}
+};
+
+//a timepoint that lands right at the edge of a frame might be a very late wakeup, or an early wakeup for the next frame. a single finder has to pick one.
+//if it picks wrong, the point drags the line, and the finder either fixes it with a frame shift, or restarts and loses lock.
+//so when the guess is ambiguous, the finder is copied, and the copy takes the other guess. both run side by side on the following timepoints, each with its own hull and error sums.
+//the wrong one gives itself away within a few timepoints: its error is higher, or it restarts. then it's dropped. only the best one is published.
+//a copy is a few kB at 256 points, and ambiguous timepoints are rare, so it's cheap.
+template <uint max_size>
+struct vsync_hypotheses {
+	seqlock<vblank_estimate> estimate; //the renderer reads this, same as a single finder
+	uint64_t estimates_published = 0;
+	vblank_estimate latest;
+	bool replaying = false;
+
+	static constexpr uint max_hypotheses = 3;
+	vsync_finder<max_size> storage[max_hypotheses];
+	uint slot[max_hypotheses] = {0, 1, 2}; //the first `live` entries are the live hypotheses, best first. the rest are free storage
+	uint age[max_hypotheses] = {}; //timepoints since the hypothesis last forked, indexed by storage
+	uint live = 1;
+
+	double ambiguity = 0.5; //see vsync_finder::ambiguous_direction()
+	uint decide_after = 4; //a hypothesis with a higher error than the best one is dropped after this many timepoints
+	double cap_multiplier = 4; //hypotheses are compared with capped_error(), capped at this many average errors of the finder before the fork
+	double cap = 0; //ticks
+	double score[max_hypotheses] = {}; //capped error, indexed by storage
+
+	vsync_finder<max_size>& best() { return storage[slot[0]]; }
+	uint elements() { return best().elements(); }
+
+	void set_nominal_period(double period, double tolerance) {
+		for (auto& h : storage)
+			h.set_nominal_period(period, tolerance);
+	}
+
+	void set_recency_half_life(double frames) {
+		for (uint h = 0; h < live; ++h) //the free slots are overwritten by a copy of the best before they're used
+			storage[slot[h]].set_recency_half_life(frames);
 	}
 
-	find_convex_line_backwards_from(this_index);
-	if (before(convex_at(this_index), middle_pivot)) {
-		middle_pivot = this_index;
+	void set_replaying(bool on) {
+		replaying = on;
+		for (auto& h : storage)
+			h.replaying = on;
 	}
-	else
-		convex_next(convex_at(this_index)) = this_index;
+	void new_values(std::span<const uint64_t> timepoints, std::span<vblank_estimate> trajectory = {}) { replay_timepoints(*this, timepoints, trajectory); }
 
-	//previous_pivot might have changed when running find_convex_line_backwards_from(this_index), since it might have fallen off the edge.
-	while (1) {
-		if (before(convex_at(middle_pivot), index_begin)) {
-			find_convex_line_backwards_from(middle_pivot);
+	void restart(uint64_t new_timepoint) {
+		live = 1;
+		best().restart(new_timepoint);
+	}
+
+	//a hypothesis that kept more timepoints is better, since the other one restarted or threw a timepoint away. then the lower error wins
+	bool better(uint a, uint b) {
+		if (storage[a].elements() != storage[b].elements())
+			return storage[a].elements() > storage[b].elements();
+		return score[a] < score[b];
+	}
+
+	void new_value(uint64_t new_timepoint) {
+		uint previous_best = slot[0];
+		uint64_t best_published = best().estimates_published;
+
+		int direction = live < max_hypotheses ? best().ambiguous_direction(new_timepoint, ambiguity) : 0;
+		uint fork = max_hypotheses;
+		if (direction) {
+			if (live == 1)
+				cap = cap_multiplier * best().average_error();
+			fork = slot[live];
+			storage[fork] = best();
+			age[fork] = age[slot[0]] = 0;
+			++live;
 		}
-		//if the oldest element expired, the middle pivot's line might not extend over the midline anymore. so move it backwards
-		uint previous_pivot = convex_at(middle_pivot);
-		if (!before(frame_at(previous_pivot) * elements(), sum_of_all_frames)) {
-			convex_next(previous_pivot) = middle_pivot;
-			middle_pivot = previous_pivot;
+		for (uint h = 0; h < live; ++h) {
+			storage[slot[h]].reporting = h == 0;
+			storage[slot[h]].new_value(new_timepoint, slot[h] == fork ? direction : 0);
+			++age[slot[h]];
 		}
-		else
-			break;
-	}
-	set_period_phase();
-	//check error
-	uint64_t error_from_baseline_times_period_denominator = period_denominator * (sum_of_all_timepoints - timepoint_at(middle_pivot) * elements()) - int(sum_of_all_frames - frame_at(middle_pivot) * elements()) * period_numerator;
-	//uint64_t average_error_in_ticks = error_from_baseline_times_period_denominator / (elements() - 2) / period_denominator;
-	//outc("vsync error is", average_error_in_ticks, "ticks", double(average_error_in_ticks) / ticks_per_sec * 1000, "ms");
-
-	//if error >= period / 4
-	//there are more than 2 elements if you arrived here, because 2 elements = early exit from function at beginning.
-	//also, 2 elements don't participate in error calculation because they are pivot points and have their error artificially zeroed. that's why we use (elements() - 2) instead of elements().
-	if (error_from_baseline_times_period_denominator >= (elements() - 2) * period_numerator / 4) {
-		debug_outc_vsync("excess error", double(error_from_baseline_times_period_denominator / (elements() - 2) / period_denominator) / ticks_per_sec * 1000, "ms, period", period_numerator * 1000 / period_denominator / ticks_per_sec, "size", elements());
-		restart(new_timepoint);
-		return;
+		if (live == 1)
+			goto publish;
+
+		for (uint h = 0; h < live; ++h)
+			score[slot[h]] = storage[slot[h]].elements() > 2 ? storage[slot[h]].capped_error(cap) : 0;
+		for (uint h = 1; h < live; ++h)
+			if (better(slot[h], slot[0]))
+				std::swap(slot[0], slot[h]);
+		for (uint h = 1; h < live;) {
+			if (storage[slot[h]].elements() < best().elements() || (age[slot[h]] >= decide_after && !better(slot[h], slot[0]))) {
+				std::swap(slot[h], slot[live - 1]);
+				--live;
+			}
+			else
+				++h;
+		}
+
+	publish:
+		if ((slot[0] == previous_best && best().estimates_published == best_published) || best().estimates_published == 0)
+			return; //nothing new to say
+		latest = best().latest;
+		latest.generation = ++estimates_published;
+		if (!replaying)
+			estimate.store(latest);
+	}
+};
+
+//the tradeoff from the measurements above vsync_finder: 4-16 points lock within a few vblanks, but they're late and noisy. 512 points are precise, but slow to react.
+//so we run a short and a long finder on the same timepoints, and serve whichever one is right at the moment.
+//while the long one fills up after a restart, it's just a short finder with more points, so it's at least as good. it serves.
+//once it's full, it can fall behind: after a period change that isn't big enough to restart it, the old points drag its line for hundreds of vblanks.
+//	the short one has already forgotten them. so if the short one is full, and the phases disagree by much more than their error, the short one serves until they agree again.
+//the two phases are never exactly equal when switching. so the difference is faded out over a few vblanks, instead of making the phase jump.
+//set_estimator(pll_estimator) swaps both for vsync_pll, at runtime, behind the same estimate. it has no window, and costs a tenth as much per timepoint.
+enum vsync_estimator_kind {
+	hull_estimator, //the short and long finders
+	pll_estimator
+};
+template <uint fast_size, uint precise_size>
+struct vsync_cascade {
+	static_assert(fast_size < precise_size, "the fast finder should be the short one");
+
+	seqlock<vblank_estimate> estimate; //the renderer reads this, same as a single finder
+	uint64_t estimates_published = 0;
+
+	vblank_estimate latest;
+	bool replaying = false;
+
+	vsync_hypotheses<fast_size> fast;
+	vsync_hypotheses<precise_size> precise;
+	vsync_pll pll; //serves instead of the finders when estimator is pll_estimator. the finders are then not fed at all, so they cost nothing
+	std::atomic<vsync_estimator_kind> estimator = hull_estimator; //set_estimator() may be called from any thread
+	vsync_estimator_kind serving = hull_estimator; //the vsync thread's copy. it changes on the next timepoint after estimator does
+
+	double agreement = 1.0; //the long finder takes over when the phases are within this many average errors. it's dropped at twice that
+	uint fade_frames = 16; //the phase difference when switching is faded out over this many estimates
+	double max_fade = 1.0 / 16; //of a period. a bigger difference isn't a finder lagging a drift: one of them is wrong, and fading toward the other would serve a phase that's neither. so the switch jumps, and the fade starts over from nothing
+
+	vsync_cascade() {
+		for (auto& h : precise.storage)
+			h.source = source_vf_precise;
 	}
-#if !NDEBUG
-	reference_verify_correctness(); //todo: maybe turn this off
-	if (period_numerator / period_denominator < ticks_per_sec / 70 || period_numerator / period_denominator > ticks_per_sec / 50)
-		debug_outc_vsync("inaccurate", period_denominator * ticks_per_sec / period_numerator, "size", elements()); //todo: this is not a good idea for other computers. also, maybe check if we don't have enough elements
-#endif
-}
 
-#if phase_error_adjustment_order_statistic
-//at 1, we want 1. at 2, we also want 1.
-unsigned order_statistic(unsigned timepoint_count) {
-	return std::lround(timepoint_count / (31 - std::countl_zero(timepoint_count) + 1));
-}
+	bool precise_serving = false;
+	double fade_offset = 0; //ticks. the phase difference when switching
+	uint fade_remaining = 0;
 
-//this returns the phase error times period_denominator. so divide by period_denominator after you get it.
-//it uses order statistics. future: compare this method with the average error (which can be blown away by black swan timepoints). maybe truncation of highest error values + average would be better.
-double estimate_phase_error() {
-	if (elements() <= 2)
-		return 0;
+	void set_nominal_period(double period, double tolerance) {
+		fast.set_nominal_period(period, tolerance);
+		precise.set_nominal_period(period, tolerance);
+		pll.set_nominal_period(period, tolerance);
+	}
+
+	//only the long finder. the short one is already short, and it's what serves when the long one falls behind
+	void set_recency_half_life(double frames) { precise.set_recency_half_life(frames); }
 
-	uint64_t error[max_size]; //static? nah, stack is fast allocation.
-	//we want to eliminate integer rounding errors. however, our period is a ratio. thus, we multiply all elements by the denominator.
-	//that way, the period is the numerator.
+	void set_replaying(bool on) {
+		replaying = on;
+		fast.set_replaying(on);
+		precise.set_replaying(on);
+		pll.set_replaying(on);
+	}
 
-	//first, we find an offset to compare to. this offset is lower than every other timepoint, so that we can use positive integer modulo, which is faster than signed integer modulo.
-	uint64_t base_offset = timepoint_at(middle_pivot) * period_denominator;
-	uint64_t lowest_timepoint = timepoint_at(index_begin) * period_denominator;
-	auto shift_base_offset = div_ceil(base_offset - lowest_timepoint, period_numerator);
-	base_offset -= shift_base_offset * period_numerator;
+	//the estimator that wasn't being fed is out of date, so it starts over at the next timepoint
+	void set_estimator(vsync_estimator_kind kind) { estimator.store(kind, std::memory_order_relaxed); }
+	void new_values(std::span<const uint64_t> timepoints, std::span<vblank_estimate> trajectory = {}) { replay_timepoints(*this, timepoints, trajectory); }
 
-	uint increment = 0;
-	for (uint x = index_begin; x != index_end; ++x) {
-		error[increment] = (timepoint_at(x) * period_denominator - base_offset) % period_numerator;
-		check(error[increment] < ticks_per_sec);
-		++increment;
+	void restart(uint64_t new_timepoint) {
+		fast.restart(new_timepoint);
+		precise.restart(new_timepoint);
+		precise_serving = false;
+		fade_remaining = 0;
+		pll.restart(new_timepoint);
 	}
 
-	//skip the two pivot points. they're always unnaturally zero.
-	check(increment == index_end - index_begin);
-	unsigned order_number = order_statistic(increment - 2);
-	std::nth_element(std::begin(error), std::begin(error) + order_number + 2, std::begin(error) + increment);
+	double fading_offset() { return fade_remaining ? fade_offset * fade_remaining / fade_frames : 0; }
 
-	const double multiplier_for_true_error = 1.0; //I'm too lazy to calculate the real constant, so this is an approximation.
-	double estimate = error[order_number + 2] * multiplier_for_true_error / ((order_number + 2) * period_denominator);
-	//outc(estimate);
-	return estimate;
-}
-#endif
+	void start_fade(double offset, double period) {
+		fade_offset = offset;
+		fade_remaining = std::abs(offset) <= max_fade * period ? fade_frames : 0;
+	}
 
-//communicate the period and phase with the client renderer.
-//this introduces a rounding error from integer arithmetic, but we have no choice, because we must reduce interaction between the vsync finder and the renderer.
-//and, the phase and period are the only atomic variables which can be varied independently. so we cannot expose our precise ratio.
-//to reduce rounding error, we position the phase on the frame after the latest frame.
-//this also helps when the phase and period are set at different times - slight variations in period will not cause the measurement to explode
-void set_period_phase() {
-	find_period_ratio();
-
-	//phase ~ index_end + period
-	//phase = round(index_end + period - timepoint_at(middle_pivot), period) * period + timepoint_at(middle_pivot)
-	//period = n/d
-	//phase = round(difference * d / n + 1) * n/d
-#if phase_error_adjustment_order_statistic
-	auto phase_error = estimate_phase_error();
-	uint64_t phase = timepoint_at(middle_pivot) + rounded_divide((frame_at(index_end - 1) - frame_at(middle_pivot) + 1) * period_numerator, period_denominator) - phase_error;
-#else
-	uint64_t phase = timepoint_at(middle_pivot) + rounded_divide((frame_at(index_end - 1) - frame_at(middle_pivot) + 1) * period_numerator, period_denominator);
-#endif
-	double period = double(period_numerator) / period_denominator;
-
-#if phase_error_adjustment_order_statistic
-	constexpr int tests = 7;
-	constexpr int tests_to_aggregate = 1000;
-	double multipliers[tests] = {-2.0, -1.0, -0.5, 0, 0.5, 1.0, 2.0};
-	static int skip_first_few = -5;
-	static double previous[tests] = {};
-	static double sums[tests] = {};
-	static double squares[tests] = {};
-	static double sum_error = 0;
-	for (int x : std::views::iota(0, tests)) {
-		double value = timepoint_at(middle_pivot) + (frame_at(index_end - 1) - frame_at(middle_pivot) + 1) * period_numerator / period_denominator - phase_error * multipliers[x];
-		if (skip_first_few >= 0) {
-			check(value - previous[x] < ticks_per_sec);
-			sums[x] += value - previous[x];
-			squares[x] += std::pow(value - previous[x], 2);
-		}
-		previous[x] = value;
-	}
-	sum_error += phase_error;
-	++skip_first_few;
-	if (skip_first_few % tests_to_aggregate == tests_to_aggregate - 1) {
-		outc("average error", sum_error / sums[0]);
-		for (int x : std::views::iota(0, tests)) {
-			outc(x, std::sqrt(squares[x] * tests_to_aggregate / std::pow(sums[x], 2) - 1), "lower is better");
-			sums[x] = 0;
-			squares[x] = 0;
-		}
-		sum_error = 0;
+	void new_value(uint64_t new_timepoint) {
+		vsync_estimator_kind kind = estimator.load(std::memory_order_relaxed);
+		if (kind != serving) {
+			serving = kind;
+			restart(new_timepoint);
+			return;
+		}
+		if (serving == pll_estimator) {
+			uint64_t pll_published = pll.estimates_published;
+			pll.new_value(new_timepoint);
+			if (pll.estimates_published == pll_published)
+				return;
+			latest = pll.latest;
+			latest.generation = ++estimates_published;
+			if (!replaying)
+				estimate.store(latest);
+			return;
+		}
+
+		uint64_t fast_published = fast.estimates_published;
+		uint64_t precise_published = precise.estimates_published;
+		fast.new_value(new_timepoint);
+		precise.new_value(new_timepoint);
+		bool fast_is_new = fast.estimates_published != fast_published;
+		bool precise_is_new = precise.estimates_published != precise_published;
+
+		vblank_estimate short_estimate = fast.latest;
+		vblank_estimate long_estimate = precise.latest;
+		bool precise_ready = precise.elements() >= 2 && precise.elements() >= fast.elements(); //it might have restarted while the short one didn't, or the other way around
+		double difference = long_estimate.period > 0 ? std::remainder(double(int64_t(short_estimate.phase - long_estimate.phase)), long_estimate.period) : 0;
+		double tolerance = agreement * long_estimate.error;
+
+		if (!precise_serving && precise_ready && precise_is_new && std::abs(difference) <= tolerance) {
+			start_fade(difference + fading_offset(), long_estimate.period);
+			precise_serving = true;
+		}
+		//the long finder restarted. its old phase is still what the renderer was syncing to, so if the short finder agrees with it within its own noise, it fades in from it like any switch.
+		//	a bigger difference is why the long one restarted, and fading would serve the wrong phase for longer. simulated with a change to 60 Hz: 400 us, and fading it took 7 more frames to lock within 50 us
+		else if (precise_serving && !precise_ready) {
+			double served = short_estimate.period > 0 ? std::remainder(double(int64_t(latest.phase - short_estimate.phase)), short_estimate.period) : 0;
+			start_fade(served, short_estimate.period);
+			if (std::abs(served) > 2 * agreement * short_estimate.error)
+				fade_remaining = 0;
+			precise_serving = false;
+		}
+		//the long finder falls behind a drift, which barely moves the two periods apart: across the short window, they differ by much less than the tolerance. a short finder whose period disagrees is following something else, like a run of wakeups getting later and later, and the long one keeps serving.
+		//simulated with the wakeups getting 0.3 periods later over 24 frames, then on time again: the short finder's period was 1.2% long when it took over, and the cascade served up to 4.6 ms of error. with the check, 4.4 us.
+		else if (precise_serving && fast.elements() == fast_size && std::abs(difference) > 2 * tolerance && std::abs(short_estimate.period - long_estimate.period) * fast_size <= tolerance) {
+			if (!replaying)
+				push_vsync_event({new_timepoint, event_long_finder_fell_behind, source_vf_precise, precise.elements(), long_estimate.period, long_estimate.error});
+			debug_outc_vsync("long finder fell behind", difference / ticks_per_sec * 1000, "ms, size", precise.elements());
+			start_fade(-difference + fading_offset(), long_estimate.period);
+			precise_serving = false;
+		}
+
+		if (precise_serving ? !precise_is_new : !fast_is_new)
+			return; //the serving finder rejected the timepoint or restarted, so it has nothing new to say
+		latest = precise_serving ? long_estimate : short_estimate;
+		latest.phase += std::llround(fading_offset());
+		if (long_estimate.drift != 0) //it's the same clock, and the long finder's periods are much less noisy, so its drift is the better one whoever serves
+			latest.drift = long_estimate.drift;
+		if (fade_remaining)
+			--fade_remaining;
+		latest.generation = ++estimates_published;
+		if (!replaying)
+			estimate.store(latest);
 	}
-#endif
+};
 
-	vblank_phase_atomic.store(phase, std::memory_order_relaxed); //phase first - reduce wobbling.
-	vblank_period_atomic.store(period, std::memory_order_relaxed);
-}
-} // namespace vf
+vsync_cascade<16, 256> vf; //16 points to lock fast, 256 points for precision. the long finder's hull costs ~0.0006 ms per timepoint, see above
@@ -0,0 +1,214 @@
+//times the estimators on synthetic traces, and measures how far they are from the truth. no window, no GL, no platform source.
+//g++ vsync_benchmark.cpp -std=c++20 -Ij -lpthread -O2
+//the costs are the estimators' alone: everything runs as a replay, so nothing is published through the seqlocks, and nothing prints.
+#include "timing.cpp"
+#include "console.h"
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <random>
+#include <vector>
+
+double system_claimed_monitor_Hz = 59.94;
+int total_scanlines = 1125;
+
+#include "vsync.cpp"
+#include "vsync_with_scanline.cpp"
+#include "vblank_fusion.cpp"
+
+//a display at 59.94 Hz, with 1 ppm/s of drift. vblank is the latest one, in ticks from origin
+struct synthetic_trace {
+	std::mt19937_64 random{1};
+	double period = 1e9 / 59.94; //timing.cpp's ticks are ns on Linux
+	double vblank = 0;
+	double drift = 1e-6; //per second
+	static constexpr uint64_t origin = 1'700'000'000'000'000'000;
+
+	double unit() { return std::uniform_real_distribution<double>(0, 1)(random); }
+	double normal() { return std::normal_distribution<double>(0, 1)(random); }
+	double exponential() { return std::exponential_distribution<double>(1)(random); }
+	uint64_t ticks(double time) { return origin + uint64_t(std::llround(time)); }
+	void next_vblank() {
+		vblank += period;
+		period *= 1 + drift * period / 1e9;
+	}
+};
+
+struct error_stats {
+	double sum = 0;
+	double squares = 0;
+	uint64_t count = 0;
+	void add(double error) {
+		sum += error;
+		squares += error * error;
+		++count;
+	}
+	double mean() { return sum / count / 1000; } //us
+	double rms() { return std::sqrt(squares / count) / 1000; }
+};
+
+constexpr uint timepoints = 100000;
+constexpr uint warmup = 3600; //a minute. the errors before it are the estimators' startup, not their steady state
+
+//heartbeat wakeups, 1 ms into the porch plus 20 us of exponential lateness. the truth is the next vblank's wakeup, without the lateness
+struct heartbeat_trace {
+	std::vector<uint64_t> wakeups;
+	std::vector<uint64_t> truth;
+	heartbeat_trace() {
+		synthetic_trace display;
+		for (uint x = 0; x < timepoints; ++x) {
+			display.next_vblank();
+			wakeups.push_back(display.ticks(display.vblank + 1e6 + 20e3 * display.exponential()));
+			truth.push_back(display.ticks(display.vblank + display.period + 1e6));
+		}
+	}
+};
+
+template <typename estimator>
+void time_heartbeat(const char* name, estimator& finder, const heartbeat_trace& trace) {
+	finder.set_replaying(true);
+	error_stats errors;
+	std::vector<uint64_t> spent(timepoints);
+	uint64_t start = now();
+	for (uint x = 0; x < timepoints; ++x) {
+		uint64_t before = now();
+		finder.new_value(trace.wakeups[x]);
+		spent[x] = now() - before;
+		if (x >= warmup && finder.latest.period > 0)
+			errors.add(double(int64_t(extrapolate_estimate(finder.latest, trace.truth[x]).phase - trace.truth[x])));
+	}
+	double total = double(now() - start) / ticks_per_sec * 1e6;
+	//the spikes, but not the worst one. that's the OS preempting the thread, or a page fault, whatever the estimator does
+	auto spike = spent.begin() + timepoints * 999 / 1000;
+	std::nth_element(spent.begin(), spike, spent.end());
+	outc(name, ":", total / timepoints, "us per timepoint, 99.9th percentile", double(*spike) / ticks_per_sec * 1e6, "us. phase rms", errors.rms(), "us, mean", errors.mean(), "us");
+}
+
+//one scanline read per rendered frame, at fps frames per second, each 0.8-1.2 of the average. the timepoint has 3 us of jitter, and the read has jitter scanlines, floored, like D3DKMTGetScanLine.
+//the truth is the next vblank after the read. the regression modes only differ in the slope, so the mean is where they differ: the slope's bias lands on the phase, half a window away
+void time_scanline(const char* name, vscan::regression_mode mode, synthetic_trace& display, double fps, double jitter) {
+	vscan::mode = mode;
+	vscan::scanline_noise_variance = 1.0 / 12 + jitter * jitter;
+	vscan::set_window(vscan::window); //starts over, on the same display
+	vscan::replaying = true;
+	error_stats errors;
+	uint64_t spent = 0;
+	double time = display.vblank;
+	for (uint x = 0; x < timepoints; ++x) {
+		time += 1e9 / fps * (0.8 + 0.4 * display.unit());
+		while (display.vblank + display.period <= time)
+			display.next_vblank();
+		double line = (time - display.vblank) / display.period * total_scanlines + jitter * display.normal();
+		uint scanline = uint(std::clamp(line, 0.0, total_scanlines - 1.0));
+		uint64_t before = now();
+		vscan::new_value(display.ticks(time + 3e3 * display.normal()), scanline);
+		spent += now() - before;
+		uint64_t truth = display.ticks(display.vblank + display.period);
+		if (x >= warmup)
+			errors.add(double(int64_t(extrapolate_estimate(vscan::latest, truth).phase - truth)));
+	}
+	vscan::replaying = false;
+	outc(name, ":", double(spent) / ticks_per_sec * 1e6 / timepoints, "us per point. phase rms", errors.rms(), "us, mean", errors.mean(), "us");
+}
+
+void time_scanline_modes(double fps, double jitter) {
+	outc("scanline,", timepoints, "reads at", fps, "fps,", jitter, "scanlines of jitter. 59.94 Hz,", total_scanlines, "lines, 1 ppm/s drift");
+	synthetic_trace display;
+	time_scanline("vscan, time_on_scanline", vscan::time_on_scanline, display, fps, jitter);
+	time_scanline("vscan, scanline_on_time", vscan::scanline_on_time, display, fps, jitter);
+	time_scanline("vscan, errors_in_variables", vscan::errors_in_variables, display, fps, jitter);
+}
+
+//vf, vscan and OML on one display, fused. the sources are simulated whether they're fed or not, so every combination sees the same trace, and the differences are the fusion's.
+//vf wakes up 1 ms into the porch plus 20 us of exponential lateness, vscan reads once per rendered frame with 0.5 scanlines of jitter and 3 us of timestamp noise, and OML's timestamps are quantized to 1 us with 0.3 us of jitter.
+//the sources sit on different edges of the vblank, and the fused phase is on the reference's. so the error is the phase's spread around its mean, like the jitter of a tearline
+struct fusion_stats {
+	double sum = 0;
+	double squares = 0;
+	uint64_t count = 0;
+	void add(double error) {
+		sum += error;
+		squares += error * error;
+		++count;
+	}
+	double spread() { return std::sqrt(squares / count - (sum / count) * (sum / count)) / 1000; } //us
+};
+
+constexpr uint fusion_frames = 120000;
+constexpr uint fusion_warmup = 20000; //OML takes over as the reference after 4096 measurements, and the offsets settle after that
+
+double fused_spread(bool use_vf, bool use_vscan, bool use_oml, uint oml_stops_at = fusion_frames) {
+	synthetic_trace display;
+	auto& fused = *new vblank_fusion;
+	fused.replaying = true;
+	auto& finder = *new vsync_cascade<16, 256>;
+	finder.set_replaying(true);
+	finder.set_nominal_period(display.period, 0.01); //like the demo
+	vscan::scanline_noise_variance = 1.0 / 12 + 0.5 * 0.5;
+	vscan::set_window(vscan::window);
+	vscan::replaying = true;
+	uint64_t previous_oml = 0;
+	int64_t oml_count = 0;
+	fusion_stats errors;
+	double time = 0;
+	for (uint x = 0; x < fusion_frames; ++x) {
+		time += display.period * (0.8 + 0.4 * display.unit());
+		while (display.vblank + display.period <= time) {
+			display.next_vblank();
+			uint64_t wakeup = display.ticks(display.vblank + 1e6 + 20e3 * display.exponential());
+			uint64_t oml = display.ticks(std::floor((display.vblank + 300 * display.normal()) / 1000) * 1000);
+			if (use_vf)
+				finder.new_value(wakeup);
+			if (use_oml && x < oml_stops_at) //like counter_to_estimate() in the demo
+				fused.add(source_oml, {.phase = oml, .period = previous_oml ? double(int64_t(oml - previous_oml)) : 0, .generation = uint64_t(++oml_count)});
+			previous_oml = oml;
+		}
+		double line = (time - display.vblank) / display.period * total_scanlines + 0.5 * display.normal();
+		uint64_t read = display.ticks(time + 3e3 * display.normal());
+		if (use_vscan) {
+			vscan::new_value(read, uint(std::clamp(line, 0.0, total_scanlines - 1.0)));
+			fused.add(source_vscan, vscan::latest);
+		}
+		if (use_vf)
+			fused.add(source_vf, finder.latest);
+		uint64_t truth = display.ticks(display.vblank + display.period);
+		if (x >= fusion_warmup && fused.latest.period > 0)
+			errors.add(double(int64_t(extrapolate_estimate(fused.latest, truth).phase - truth)));
+	}
+	vscan::replaying = false;
+	delete &finder;
+	delete &fused;
+	return errors.spread();
+}
+
+void time_fusion() {
+	outc("fusion,", fusion_frames, "rendered frames at 59.94 Hz, 1 ppm/s drift. phase spread:");
+	outc("alone: vf", fused_spread(true, false, false), "us, vscan", fused_spread(false, true, false), "us, OML through the filter", fused_spread(false, false, true), "us");
+	outc("fused: all three", fused_spread(true, true, true), "us, vf and OML", fused_spread(true, false, true), "us, vscan and OML", fused_spread(false, true, true), "us, vf and vscan", fused_spread(true, true, false), "us");
+	outc("all three, OML stops halfway:", fused_spread(true, true, true, (fusion_frames + fusion_warmup) / 2), "us");
+}
+
+int main() {
+	outc("heartbeat,", timepoints, "timepoints at 59.94 Hz, 20 us exponential lateness, 1 ppm/s drift");
+	heartbeat_trace trace;
+	{
+		auto& finder = *new vsync_finder<256>;
+		time_heartbeat("one vsync_finder<256>", finder, trace);
+		delete &finder;
+	}
+	{
+		auto& cascade = *new vsync_cascade<16, 256>;
+		time_heartbeat("vf, the cascade of 16 and 256", cascade, trace);
+		delete &cascade;
+	}
+	{
+		auto& cascade = *new vsync_cascade<16, 256>;
+		cascade.set_estimator(pll_estimator);
+		time_heartbeat("vf with pll_estimator", cascade, trace);
+		delete &cascade;
+	}
+
+	time_scanline_modes(59.94, 0.5);
+	time_scanline_modes(2000, 5); //the window spans 8 frames, and the jitter's attenuation of the slope shows
+	time_fusion();
+}
@@ -0,0 +1,147 @@
+#pragma once
+#include "timing.h"
+#include <atomic>
+#include <cstdint>
+
+//the estimators' diagnostics used to be only outc() strings. printing on the vsync thread makes the tearline wobble, and strings can't be counted.
+//so every anomaly is also a small typed record, pushed into a lock-free ring. a consumer thread drains it whenever it likes, and does the printing and counting there.
+//pushing never blocks and never allocates. if the ring is full, the event is dropped and counted, since the timing thread must not wait for the consumer.
+
+enum vsync_event_reason : uint8_t {
+	event_restart, //the window was thrown away. the events before it say why
+	event_excess_error,
+	event_multiframe_restart, //too many multi-frame timepoints, and no rational multiple of the period explains them
+	event_long_multiframe, //a long gap, usually alt-tab
+	event_window_too_long, //the window ran into the span limits of the integer arithmetic
+	event_zero_frame, //two timepoints in one frame
+	event_frame_shift, //a frame guess was corrected instead of restarting
+	event_prior_contradicted,
+	event_out_of_band, //the period left the band around the modeline's
+	event_nominal_dropped, //the band kept disagreeing, so the modeline's period is stale
+	event_window_resized, //the self-tuning window grew or shrank
+	event_reframed, //the frames were re-guessed with a rational multiple of the period, instead of restarting
+	event_long_finder_fell_behind, //the cascade switched back to the short finder
+	event_heartbeat_lost, //waiting for a vblank failed. the computer probably went to sleep
+	event_scanline_skip, //vscan: the renderer missed one or more frames
+	event_scanline_quarantined, //vscan: a point could be in either of two frames, so it was left out
+	event_pll_unlocked, //vsync_pll: the loop's error grew past its lock threshold, so it widened to pull in again
+	event_fusion_rejected, //vblank_fusion: a source's estimate was too far from the fused one. the error field has the distance
+	event_oml_counter_reset, //glXGetSyncValuesOML: the vblank counter went backwards
+	event_oml_period_jump, //glXGetSyncValuesOML: the period between reads disagrees with the modeline
+	event_reason_count
+};
+
+inline const char* event_reason_name(vsync_event_reason reason) {
+	static const char* names[event_reason_count] = {"restart", "excess error", "multi-frame restart", "long multi-frame", "window too long", "zero frame", "frame shift", "prior contradicted", "out of band", "nominal dropped", "window resized", "reframed", "long finder fell behind", "heartbeat lost", "scanline skip", "scanline quarantined", "PLL unlocked", "fusion rejected", "OML counter reset", "OML period jump"};
+	return reason < event_reason_count ? names[reason] : "unknown";
+}
+
+enum vsync_event_source : uint8_t {
+	source_vf, //a single finder, or the short finder of vf
+	source_vf_precise, //the long finder of vf
+	source_vscan,
+	source_oml,
+	source_fusion,
+	source_pll, //vf's loop, when it serves instead of the finders
+	source_count
+};
+
+struct vsync_event {
+	uint64_t timestamp = 0; //ticks. the timepoint that was being processed
+	vsync_event_reason reason = event_restart;
+	vsync_event_source source = source_vf;
+	unsigned elements = 0; //the window's length when it happened
+	double period = 0; //ticks. 0 if there wasn't one yet
+	double error = 0; //average error, ticks. 0 if there wasn't one yet
+};
+
+//bounded, multiple producers, one consumer. each slot has a sequence number that says whose turn it is: a producer claims a slot by bumping head, fills it, then hands it to the consumer by bumping the slot's sequence.
+//the producers are the vsync thread (vf) and the render thread (vscan, OML), so there are two of them at most, and a claim almost never retries.
+template <typename T, unsigned size>
+struct event_ring {
+	static_assert(size >= 2 && (size & (size - 1)) == 0, "size must be a power of 2");
+	struct slot {
+		std::atomic_uint64_t sequence;
+		T value;
+	};
+	slot slots[size];
+	std::atomic_uint64_t head = 0; //next slot to claim
+	uint64_t tail = 0; //next slot to read. only the consumer touches it
+	std::atomic_uint64_t dropped = 0;
+
+	event_ring() {
+		for (unsigned x = 0; x < size; ++x)
+			slots[x].sequence.store(x, std::memory_order_relaxed);
+	}
+
+	//returns false if the ring is full. the event is then dropped
+	bool push(const T& value) {
+		uint64_t position = head.load(std::memory_order_relaxed);
+		while (1) {
+			slot& s = slots[position % size];
+			int64_t lag = int64_t(s.sequence.load(std::memory_order_acquire) - position);
+			if (lag == 0) {
+				if (head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if (lag < 0) { //the consumer hasn't read this slot since the last lap
+				dropped.fetch_add(1, std::memory_order_relaxed);
+				return false;
+			}
+			else
+				position = head.load(std::memory_order_relaxed);
+		}
+		slot& s = slots[position % size];
+		s.value = value;
+		s.sequence.store(position + 1, std::memory_order_release);
+		return true;
+	}
+
+	//consumer only. returns false if the ring is empty
+	bool pop(T& value) {
+		slot& s = slots[tail % size];
+		if (s.sequence.load(std::memory_order_acquire) != tail + 1)
+			return false;
+		value = s.value;
+		s.sequence.store(tail + size, std::memory_order_release);
+		++tail;
+		return true;
+	}
+};
+
+event_ring<vsync_event, 1024> vsync_events; //a second of events at 1000 Hz, which is far more than a healthy system produces in an hour
+
+void push_vsync_event(const vsync_event& event) { vsync_events.push(event); }
+
+//what a consumer keeps: counts per reason and source, since the start or since the last reset.
+//restarts per hour is restarts / hours(). the consumer decides when to print and reset
+struct vsync_event_counts {
+	uint64_t counts[event_reason_count] = {};
+	uint64_t by_source[source_count] = {};
+	uint64_t dropped_before = 0; //vsync_events.dropped at the last reset
+	uint64_t since = now();
+	void (*on_event)(const vsync_event& event) = nullptr; //optional, for printing or logging each event. it runs on the consumer's thread
+
+	//drains the ring. call it from one thread only
+	void drain() {
+		vsync_event event;
+		while (vsync_events.pop(event)) {
+			if (on_event)
+				on_event(event);
+			if (event.reason < event_reason_count)
+				++counts[event.reason];
+			if (event.source < source_count)
+				++by_source[event.source];
+		}
+	}
+
+	uint64_t dropped() { return vsync_events.dropped.load(std::memory_order_relaxed) - dropped_before; }
+	double hours() { return double(now() - since) / ticks_per_sec / 3600; }
+
+	void reset() {
+		auto callback = on_event;
+		*this = {};
+		on_event = callback;
+		dropped_before = vsync_events.dropped.load(std::memory_order_relaxed);
+	}
+};
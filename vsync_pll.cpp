@@ -0,0 +1,254 @@
+#pragma once
+#include "period_drift.h"
+#include "seqlock.h"
+#include "timing.h"
+#include "vblank_estimate.h"
+#include "vsync_events.cpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+//vsync_finder keeps a window, and its cost and its recovery after a restart depend on the window's size. this is the other way to follow a clock: a phase-locked loop.
+//it keeps no timepoints, only a predicted vblank and a period. each timepoint is compared with the prediction, and the difference steers both. a few multiplies per timepoint, and no buffer.
+//it's a second-order loop (PI): the phase moves by a * error, and the period by b * error. a second-order loop follows a period that's off with no lasting phase error.
+//	a = 2 * damping * w, b = w^2, where w = 2 pi * bandwidth * period is the natural frequency in radians per frame.
+//	a wider loop follows changes faster, and passes more of the wakeup noise. so it starts wide, to pull in from the claimed refresh rate, and narrows when it's locked.
+//the discriminator is asymmetric, since wakeups are never early, only late by various amounts. a timepoint before the prediction means the vblank is earlier than we thought, and counts fully.
+//	a timepoint after it is probably a late wakeup, and counts by late_weight. the loop then settles where the early side balances late_weight of the late side: near the earliest wakeups, like vf's hull.
+//	late errors are also clipped at clip times the average error, so every wakeup later than that moves the loop by the same small step, however late it is.
+//	a wakeup more than 1 - early_margin of a period late lands in the next frame, as an early error. so an early error beyond the clip moves the timepoint a frame back, where it's a late one. an early error that can't, counts clipped too, once locked.
+//lock detection: a lowpass of the discriminator's size. below lock_threshold of a period for lock_frames in a row, the loop is locked and narrows. above twice that, it's unlocked, and widens again.
+//	a loop that stays unlocked for max_unlocks * lock_frames can't pull in, usually after a mode change. it starts over without the nominal period, and measures the period from the gaps.
+//the loop's period lags behind drift: a period that grows by r per frame leaves the phase r / b behind. 1 ppm/s at 60 Hz is 0.28 ticks per frame, and 2.5 us behind at 0.1 Hz.
+//	so the period is fed to period_drift_filter, like vf's windows, and the measured drift is added to the period every frame. the loop only has to correct what's left.
+//simulated at 59.94 Hz, claimed as 60 Hz, wakeups 1 ms into the porch plus 20 us exponential, 1 ppm/s drift. phase rms of the next vblank, after the first minute, pll against vf:
+//	0.77 us against 0.57. without drift, 0.76 against 0.29. at 5 ppm/s, 0.80 against 1.3. with 10% of the vblanks skipped, 0.80 against 0.65. with 100 us lateness, 3.8 against 1.6.
+//	with 3% of the wakeups 30x the average lateness late, 0.88 against 0.60: the hull never touches them, and the loop still feels each one a little. with 10% skipped and 3% half a period late, 0.96 against 0.69.
+//	with 3% of the wakeups 0.54-1.26 periods late, 0.87 against 0.81. before late wakeups in the next frame were moved back, their early errors set the phase 490 us early.
+//	it locks after 255 frames, 346 claimed as 59 Hz, and 270 without a nominal period. after a mode change to 144 Hz, it locks again after 2300 frames, and to 50 Hz after 1100.
+//	it costs 0.15 us per timepoint, against 2.8 us for vf's two finders.
+struct vsync_pll {
+	seqlock<vblank_estimate> estimate; //the renderer reads this, same as a finder
+	uint64_t estimates_published = 0;
+	vblank_estimate latest;
+	bool replaying = false;
+	period_drift_filter drift_filter;
+
+	double bandwidth = 0.1; //Hz, when locked
+	double acquire_bandwidth = 1; //Hz, while pulling in
+	double damping = 0.707;
+	double late_weight = 1.0 / 8;
+	double clip = 3; //of error. only for late timepoints, the early ones are what the loop locks onto
+	double lock_threshold = 0.005; //of a period. 83 us at 60 Hz
+	uint lock_frames = 256; //4 seconds at 60 Hz. a loop that just pulled in is still ringing, and anything learned while locked would learn the ringing
+	double lock_rate = 1.0 / 32; //of the lock detector's lowpass
+	double early_rate = 1.0 / 256;
+	double early_multiplier = 1.85; //phase_correction = early_multiplier * early. 2 if the wakeups below the lock point were spread evenly. exponential lateness crowds them toward the vblank, and simulates to 1.85
+	uint max_gap = 120; //frames. a longer gap restarts, since the phase has wandered by gap * the period's error
+	double early_margin = 0.25; //of a period. a timepoint belongs to the last vblank that's at most this far after it, see new_value()
+	double nominal_low = 0; //ticks. the period is kept in [nominal_low, nominal_high], if they're set
+	double nominal_high = 0;
+	double nominal_period = 0; //0 if there's none, or it was dropped. the period is then measured from the first gaps
+	uint unlocks_in_a_row = 0;
+	static constexpr uint max_unlocks = 4; //if the loop is reported unlocked this many times in a row, it can't pull in. it starts over from the gaps, and drops the nominal period, like vsync_finder drops a stale one
+
+	//without a nominal period, the period is the median of the first gaps after a restart. a skipped vblank makes one gap 2 periods, and a late wakeup makes one gap long and the next one short, and neither moves the median.
+	//	it's wrong if most of the vblanks are skipped, and then the loop locks onto a multiple of the period.
+	static constexpr uint first_gaps = 15;
+	uint64_t first_timepoints[first_gaps + 1];
+	uint first_count = 0;
+
+	bool started = false;
+	bool locked = false;
+	uint64_t vblank = 0; //ticks. the predicted vblank of the last timepoint is vblank + fraction
+	double fraction = 0; //ticks, in [0, 1). the phase's sub-tick part, so the doubles never hold a large number
+	double period = 0; //ticks
+	double lock_lowpass = 0; //ticks. lowpass of |discriminator|
+	double error = 0; //ticks. lowpass of how far the timepoints are from their vblanks
+	double early = 0; //ticks. lowpass of how far the early timepoints are before the prediction. the loop locks onto a low quantile of the wakeups, which is still late.
+	//but the wakeups below it are spread about evenly from the true vblank up to it, so they're half as early as it's late. like phase_error_filter, it describes the system, so it's kept through restarts
+	uint frames_in_lock = 0;
+	uint frames_unlocked = 0; //since the last report
+	uint64_t points = 0; //timepoints since the last restart
+
+	void set_nominal_period(double nominal, double tolerance) {
+		nominal_period = nominal;
+		nominal_low = nominal * (1 - tolerance);
+		nominal_high = nominal * (1 + tolerance);
+	}
+
+	void set_replaying(bool on) { replaying = on; }
+
+	void report(vsync_event_reason reason, uint64_t timepoint) {
+		if (!replaying)
+			push_vsync_event({timepoint, reason, source_pll, unsigned(std::min<uint64_t>(points, ~0u)), period, error});
+	}
+
+	//a restart keeps the period if the loop was locked. a long gap doesn't make the period wrong
+	void restart(uint64_t new_timepoint) {
+		if (started)
+			report(event_restart, new_timepoint);
+		if (!locked)
+			period = nominal_period; //0 if there's none. the period is then measured again, from this timepoint on
+		started = false;
+		locked = false;
+		lock_lowpass = 0;
+		frames_in_lock = 0;
+		frames_unlocked = 0;
+		first_count = 0;
+		start(new_timepoint);
+	}
+
+	//the first timepoint after a restart. returns false while the period is still being measured
+	bool start(uint64_t new_timepoint) {
+		if (period <= 0 && !measure_period(new_timepoint))
+			return false;
+		started = true;
+		vblank = new_timepoint;
+		fraction = 0;
+		points = 1;
+		return true;
+	}
+
+	//collects the first gaps. returns true when it has set the period
+	bool measure_period(uint64_t new_timepoint) {
+		if (first_count && new_timepoint <= first_timepoints[first_count - 1])
+			return false;
+		first_timepoints[first_count++] = new_timepoint;
+		if (first_count <= first_gaps)
+			return false;
+		double gaps[first_gaps];
+		for (uint x = 0; x < first_gaps; ++x)
+			gaps[x] = double(first_timepoints[x + 1] - first_timepoints[x]);
+		std::nth_element(gaps, gaps + first_gaps / 2, gaps + first_gaps);
+		period = gaps[first_gaps / 2];
+		first_count = 0;
+		return true;
+	}
+
+	//the nominal period is dropped too, since it didn't lead to a lock. the next period comes from the gaps
+	void start_over(uint64_t new_timepoint) {
+		if (nominal_period > 0)
+			report(event_nominal_dropped, new_timepoint);
+		nominal_low = nominal_high = nominal_period = 0;
+		unlocks_in_a_row = 0;
+		locked = false;
+		restart(new_timepoint);
+	}
+
+	//the loop's gains for a bandwidth, see the top
+	double natural_frequency(double Hz) { return 2 * 3.14159265358979 * Hz * period / ticks_per_sec; }
+
+	void new_value(uint64_t new_timepoint) {
+		if (!started) {
+			if (period <= 0)
+				period = nominal_period;
+			if (start(new_timepoint))
+				publish();
+			return;
+		}
+		//wakeups are late, never early. rounding to the nearest vblank put a wakeup half a period late into the next frame, as an early error of half a period, which counts fully. a few of those and the loop never locked.
+		//so a timepoint is early by at most early_margin of a period, and late by up to the rest: a wakeup 3/4 of a period late is still a late one, which is clipped.
+		double distance = double(int64_t(new_timepoint - vblank)) - fraction;
+		double frames = std::floor(distance / period + early_margin);
+		if (frames <= 0) {
+			report(event_zero_frame, new_timepoint);
+			return;
+		}
+		if (frames > max_gap) {
+			report(event_long_multiframe, new_timepoint);
+			restart(new_timepoint);
+			if (started)
+				publish();
+			return;
+		}
+		++points;
+
+		//the drift the filter found, added as the loop goes. rate is the period's relative change per tick
+		double rate = drift_filter.drift() * 1e-6 / ticks_per_sec;
+		double predicted = frames * period * (1 + rate * frames * period / 2);
+		//a wakeup more than 1 - early_margin of a period late lands in the next frame, as an early error. early errors count fully, and 1% of them 0.54-1.26 periods late moved the phase 170 us early.
+		//	once locked, the wakeups are never more than a few errors early. so an early error beyond the clip is a late wakeup from the frame before, and counts as one
+		if (error > 0 && distance - predicted < -clip * error && frames > 1) {
+			--frames;
+			predicted = frames * period * (1 + rate * frames * period / 2);
+		}
+		period *= 1 + rate * frames * period;
+		double phase_error = distance - predicted; //positive: the timepoint is after the predicted vblank
+
+		double discriminator = phase_error;
+		if (phase_error > 0) {
+			discriminator *= late_weight;
+			if (error > 0) //also while pulling in. an unclipped wakeup half a period late moved the period by 0.07% at the acquiring bandwidth
+				discriminator = std::min(discriminator, clip * late_weight * error);
+		}
+		else if (locked) //an early error that couldn't move a frame back, such as a second wakeup in one frame
+			discriminator = std::max(discriminator, -clip * error);
+		double w = natural_frequency(locked ? bandwidth : acquire_bandwidth);
+		double step = predicted + 2 * damping * w * discriminator;
+		period += w * w * discriminator;
+		if (nominal_high > 0)
+			period = std::clamp(period, nominal_low, nominal_high);
+
+		//moving the whole ticks into vblank
+		step += fraction;
+		double whole = std::floor(step);
+		vblank += int64_t(whole);
+		fraction = step - whole;
+
+		double distance_after = std::abs(phase_error);
+		if (locked) //clipped like the discriminator. otherwise 3% of wakeups half a period late make the error 240 us, and the clip lets through everything
+			distance_after = std::min(distance_after, clip * error);
+		error = error == 0 ? distance_after : error + (distance_after - error) * lock_rate;
+		lock_lowpass += (std::abs(discriminator) - lock_lowpass) * lock_rate;
+		if (locked && phase_error < 0) //while pulling in, the errors are the loop's, not the wakeups'
+			early = early == 0 ? -phase_error : early + (std::min(-phase_error, clip * error) - early) * early_rate;
+		if (lock_lowpass < lock_threshold * period) {
+			if (++frames_in_lock >= lock_frames && !locked) {
+				locked = true;
+				unlocks_in_a_row = 0;
+			}
+		}
+		else if (lock_lowpass > 2 * lock_threshold * period) {
+			if (locked) {
+				report(event_pll_unlocked, new_timepoint);
+				++unlocks_in_a_row;
+			}
+			locked = false;
+			frames_in_lock = 0;
+		}
+		//a loop that can't pull in is reported again every lock_frames. after a mode change from 60 to 144 Hz, the band held the period at its low edge forever. from 60 to 50 Hz, the period wandered inside the band, with every timepoint in the wrong frame
+		if (locked)
+			frames_unlocked = 0;
+		else if (++frames_unlocked >= lock_frames) {
+			report(event_pll_unlocked, new_timepoint);
+			frames_unlocked = 0;
+			if (++unlocks_in_a_row >= max_unlocks) {
+				start_over(new_timepoint);
+				if (started)
+					publish();
+				return;
+			}
+		}
+		if (locked)
+			drift_filter.add(vblank, period);
+		publish();
+	}
+
+	void publish() {
+		double phase_correction = locked ? early_multiplier * early : 0;
+		latest.phase = vblank + int64_t(std::llround(fraction + period - phase_correction)); //the next vblank, like vf
+		latest.period = period;
+		latest.period_numerator = latest.period_denominator = 0;
+		double memory = 1 / (2 * damping * natural_frequency(locked ? bandwidth : acquire_bandwidth)); //frames the loop averages over, roughly
+		latest.elements = unsigned(std::min<double>(points, memory));
+		latest.window_size = 0;
+		latest.error = error;
+		latest.phase_correction = phase_correction;
+		latest.cadence = 0;
+		latest.drift = drift_filter.drift();
+		latest.generation = ++estimates_published;
+		if (!replaying)
+			estimate.store(latest);
+	}
+};
@@ -0,0 +1,602 @@
+//regression tests for the estimators, on a simulated display. no window, no GL, no platform source.
+//g++ vsync_test.cpp -std=c++20 -Ij -lpthread -O2
+//prints what it checks, and stops at the first failure.
+#include "timing.cpp"
+#include "console.h"
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <thread>
+
+double system_claimed_monitor_Hz = 59.94;
+int total_scanlines = 1125;
+
+#include "vsync.cpp"
+#include "vsync_with_scanline.cpp"
+#include "vblank_fusion.cpp"
+
+//a heartbeat thread on a display with drift. each wakeup is 1 ms after its vblank, plus 20 us of exponential noise.
+//skip_chance of the vblanks get no wakeup at all, and late_chance of the wakeups are late by about late_fraction of a period, the way a preempted thread is.
+struct simulated_heartbeat {
+	std::mt19937_64 random;
+	double period = 1e9 / 59.94; //ns, which are ticks here. timing.cpp's ticks are ns on Linux
+	double vblank = 0;
+	double drift = 1e-6; //per second
+	double skip_chance = 0.1;
+	double late_chance = 0.03;
+	double late_fraction = 0.5;
+	static constexpr uint64_t origin = 1'700'000'000'000'000'000;
+
+	simulated_heartbeat(uint64_t seed) : random(seed) {}
+	double unit() { return std::uniform_real_distribution<double>(0, 1)(random); }
+	uint64_t ticks(double time) { return origin + uint64_t(std::llround(time)); }
+
+	//advances one vblank. returns false if this vblank has no wakeup
+	bool next(uint64_t& wakeup) {
+		vblank += period;
+		period *= 1 + drift * period / 1e9;
+		if (unit() < skip_chance)
+			return false;
+		double late = unit() < late_chance ? period * late_fraction * (0.6 + 0.8 * unit()) : 0;
+		wakeup = ticks(vblank + 1e6 + 20e3 * std::exponential_distribution<double>(1)(random) + late);
+		return true;
+	}
+	//how far estimate's prediction of the next vblank's wakeup is from the real one, without the noise
+	double prediction_error(const vblank_estimate& estimate) {
+		uint64_t truth = ticks(vblank + period + 1e6);
+		return double(int64_t(extrapolate_estimate(estimate, truth).phase - truth));
+	}
+};
+
+//the ring has two producers, the vsync thread and the render thread, and one consumer. every pushed event must come out exactly once, in each producer's order, and every other one must be counted as dropped.
+//	a small ring is pushed past full, so both the drops and the wraparound of the slots' sequences are exercised
+void test_event_ring_counts() {
+	constexpr uint producers = 2, per_producer = 200000;
+	auto& ring = *new event_ring<vsync_event, 64>;
+	std::atomic_uint accepted = 0;
+	std::thread threads[producers];
+	for (uint p = 0; p < producers; ++p)
+		threads[p] = std::thread([&, p] {
+			for (uint i = 0; i < per_producer; ++i) {
+				accepted += ring.push({i, event_restart, vsync_event_source(p), p});
+				if (i % 32 == 0) //bursts, like the real producers. without a pause, a producer outruns the consumer and nearly everything is dropped
+					std::this_thread::yield();
+			}
+		});
+	uint64_t popped = 0, next[producers] = {};
+	bool in_order = true, done = false;
+	while (!done) {
+		done = accepted + ring.dropped == producers * per_producer;
+		vsync_event event;
+		while (ring.pop(event)) {
+			++popped;
+			in_order = in_order && event.elements < producers && event.timestamp >= next[event.elements];
+			next[event.elements] = event.timestamp + 1;
+		}
+	}
+	for (auto& thread : threads)
+		thread.join();
+	uint64_t dropped = ring.dropped;
+	delete &ring;
+	check(in_order, "a producer's events came out of order, or garbled");
+	check(popped == accepted && accepted + dropped == producers * per_producer, "the ring lost or duplicated events", popped, accepted.load(), dropped);
+	check(popped > 64 && dropped > 0, "the ring wasn't pushed past full, or never wrapped around", popped, dropped);
+	outc("event ring, 2 producers:", popped, "events popped once each,", dropped, "counted as dropped");
+}
+
+//vscan's sums are centered on an origin that moves with the window. they must stay exact at simulated_heartbeat's origin, 1.7e18 ticks, which is 54 years of nanoseconds.
+//	the wrapping 64-bit sums of absolute timepoints they replaced lost the squares immediately there, and the error was garbage
+//	so the sums are rebuilt from the window, and must match to the last bit, long after the window and its origin have moved on.
+//	the error must match a two-pass computation of the same thing to the 5 digits standard_error() keeps. it was within 2.4e-6
+void test_vscan_sums_exact() {
+	simulated_heartbeat display(1);
+	std::normal_distribution<double> normal(0, 1);
+	vscan::scanline_noise_variance = 1.0 / 12 + 0.5 * 0.5;
+	vscan::set_window(vscan::rectangular_window);
+	vscan::replaying = true;
+	uint64_t wakeup;
+	for (uint x = 1; x <= 20000; ++x) {
+		display.next(wakeup);
+		double time = display.vblank + display.period * display.unit();
+		double line = (time - display.vblank) / display.period * total_scanlines + 0.5 * normal(display.random);
+		vscan::new_value(display.ticks(time + 3e3 * normal(display.random)), uint(std::clamp(line, 0.0, total_scanlines - 1.0)));
+		if (x % 997 != 0)
+			continue;
+		using namespace vscan;
+		int128 w = 0, t = 0, s = 0, tt = 0, ts = 0, ss = 0;
+		for (uint i = index_begin; i != index_end; ++i) {
+			w += weight_at(i);
+			t += weight_at(i) * int128(t_at(i));
+			s += weight_at(i) * int128(s_at(i));
+			tt += weight_at(i) * int128(t_at(i)) * t_at(i);
+			ts += weight_at(i) * int128(t_at(i)) * s_at(i);
+			ss += weight_at(i) * int128(s_at(i)) * s_at(i);
+		}
+		check(w == sum_w && t == sum_t && s == sum_s && tt == sum_tt && ts == sum_ts && ss == sum_ss, "vscan's sums drifted from the window", x, to_double(tt - sum_tt), to_double(ss - sum_ss));
+		double mean_t = to_double(t) / to_double(w), mean_s = to_double(s) / to_double(w), squares = 0;
+		for (uint i = index_begin; i != index_end; ++i) {
+			double residual = t_at(i) - mean_t - ticks_per_scanline * (s_at(i) - mean_s);
+			squares += weight_at(i) * residual * residual;
+		}
+		double two_pass = std::sqrt(squares / to_double(w) * elements() / (elements() - 2));
+		check(std::abs(standard_error(ticks_per_scanline) - two_pass) < 1e-5 * two_pass, "vscan's error isn't the window's", x, standard_error(ticks_per_scanline), two_pass);
+	}
+	vscan::replaying = false;
+	outc("vscan at a 1.7e18 tick origin: the sums are exact, and the error is", vscan::standard_error(vscan::ticks_per_scanline), "ticks");
+}
+
+//a point whose time and scanline put it halfway between two frames can't be placed in either. vscan used to round it into one, and a wrong frame bent the regression for a whole window.
+//	now it's quarantined: left out, and the estimate doesn't change. the points around it are placed as usual
+void test_vscan_quarantines_ambiguous_point() {
+	simulated_heartbeat display(2);
+	std::normal_distribution<double> normal(0, 1);
+	vscan::scanline_noise_variance = 1.0 / 12 + 0.5 * 0.5;
+	vscan::set_window(vscan::rectangular_window);
+	vscan::replaying = true;
+	auto read = [&](double shift) { //a read somewhere in the current frame, reported shift periods later than it happened
+		double time = display.vblank + display.period * display.unit();
+		double line = (time - display.vblank) / display.period * total_scanlines + 0.5 * normal(display.random);
+		vscan::new_value(display.ticks(time + shift * display.period + 3e3 * normal(display.random)), uint(std::clamp(line, 0.0, total_scanlines - 1.0)));
+	};
+	uint64_t wakeup;
+	for (uint x = 0; x < 3000; ++x) {
+		display.next(wakeup);
+		if (x == 2000) {
+			uint64_t published = vscan::estimates_published;
+			vblank_estimate before = vscan::latest;
+			read(0.5);
+			check(vscan::estimates_published == published && vscan::latest.phase == before.phase && vscan::quarantined_in_a_row == 1, "the ambiguous point was placed in a frame", vscan::estimates_published - published, vscan::quarantined_in_a_row);
+			continue;
+		}
+		uint64_t published = vscan::estimates_published;
+		read(0);
+		check(x < 100 || vscan::estimates_published == published + 1, "a clean point was quarantined", x);
+	}
+	double error = std::remainder(double(int64_t(extrapolate_estimate(vscan::latest, display.ticks(display.vblank + display.period)).phase - display.ticks(display.vblank + display.period))), display.period);
+	check(std::abs(error) < 20e3, "vscan lost the vblank after the ambiguous point", error);
+	vscan::replaying = false;
+	outc("vscan, a point halfway between frames: quarantined, and the window goes on");
+}
+
+//a timepoint given a frame or two too many sits a period or two under the line, and the error check fails. it used to restart, and the window took 32 timepoints to come back.
+//	now the finder shifts the point back to its own frame, and keeps the window
+void test_frame_shift_keeps_window() {
+	for (int misassigned : {1, 2})
+		for (uint64_t seed = 1; seed <= 5; ++seed) {
+			simulated_heartbeat display(seed);
+			display.skip_chance = display.late_chance = 0; //every gap is 1 frame
+			auto& finder = *new vsync_finder<32>;
+			finder.set_replaying(true);
+			uint64_t wakeup;
+			for (uint x = 0; x < 3000; ++x) {
+				display.next(wakeup);
+				if (x != 2000) {
+					finder.new_value(wakeup);
+					continue;
+				}
+				uint elements = finder.elements();
+				uint previous_frame = finder.frame_at(finder.index_end - 1);
+				finder.new_value(wakeup, misassigned);
+				check(finder.elements() == elements && finder.frame_at(finder.index_end - 1) - previous_frame == 1, "the misassigned point wasn't shifted back", misassigned, seed, finder.elements(), finder.frame_at(finder.index_end - 1) - previous_frame);
+				check(std::abs(display.prediction_error(finder.latest)) < 20e3, "the line moved after the frame shift", misassigned, seed, display.prediction_error(finder.latest));
+			}
+			delete &finder;
+		}
+	outc("misassigned frame: shifted back, the window is kept");
+}
+
+//without a nominal period, a few late wakeups make the line loose enough that half its period fits the window too. that must not be taken as a reframe.
+void test_no_nominal_keeps_period() {
+	for (uint64_t seed = 1; seed <= 4; ++seed) {
+		simulated_heartbeat display(seed);
+		auto& finder = *new vsync_finder<16>;
+		finder.set_replaying(true);
+		uint64_t wakeup;
+		for (uint x = 0; x < 100000; ++x) {
+			if (!display.next(wakeup))
+				continue;
+			finder.new_value(wakeup);
+			if (finder.elements() >= finder.trusted_elements)
+				check(std::abs(finder.latest.period / display.period - 1) < 0.01, "windowed finder lost its period", seed, x, finder.latest.period, display.period);
+		}
+		delete &finder;
+	}
+	outc("no nominal, late wakeups: the period holds");
+}
+
+//a run of wakeups getting later and later gives the short finder a wrong period, and a phase far from the long finder's. it must not take over, and no switch may fade across a large part of a period.
+void test_cascade_ignores_lateness_ramp() {
+	for (uint64_t seed = 1; seed <= 3; ++seed) {
+		simulated_heartbeat display(seed);
+		display.drift = 0;
+		display.late_chance = 0;
+		auto& cascade = *new vsync_cascade<16, 256>;
+		cascade.set_replaying(true);
+		uint64_t wakeup;
+		double worst = 0;
+		for (uint x = 0; x < 40000; ++x) {
+			uint ramp = x - 30000; //the wakeups get 0.3 periods later over 24 frames, then they're on time again
+			double late = ramp < 24 ? 0.3 * display.period * ramp / 24 : 0;
+			if (!display.next(wakeup))
+				continue;
+			cascade.new_value(wakeup + uint64_t(late));
+			check(!cascade.fade_remaining || std::abs(cascade.fade_offset) <= cascade.max_fade * display.period, "the cascade faded across a large part of a period", seed, x, cascade.fade_offset);
+			if (x > 20000)
+				worst = std::max(worst, std::abs(display.prediction_error(cascade.latest)));
+		}
+		check(worst < 100e3, "the cascade handed over to a short finder with the wrong period", seed, worst);
+		delete &cascade;
+	}
+	outc("lateness ramp: the long finder keeps serving");
+}
+
+//the loop must pull in from the gaps when there's no nominal period, and lock through skips and wakeups half a period late. it used to never lock, and served milliseconds of error
+void test_pll_locks_without_nominal() {
+	for (uint64_t seed = 1; seed <= 3; ++seed) {
+		simulated_heartbeat display(seed);
+		auto& pll = *new vsync_pll;
+		pll.set_replaying(true);
+		uint64_t wakeup;
+		double squares = 0;
+		uint count = 0;
+		for (uint x = 0; x < 20000; ++x) {
+			if (!display.next(wakeup))
+				continue;
+			pll.new_value(wakeup);
+			if (x > 3600) {
+				double error = display.prediction_error(pll.latest);
+				squares += error * error;
+				++count;
+			}
+		}
+		check(pll.locked, "the loop never locked", seed);
+		double rms = std::sqrt(squares / count);
+		check(rms < 5e3, "the loop locked badly", seed, rms);
+		delete &pll;
+	}
+	outc("pll without a nominal period: it locks");
+}
+
+//after a mode change out of the band, the loop must drop the nominal period and lock onto the new one. the band used to hold it at its edge forever
+void test_pll_follows_mode_change() {
+	for (double Hz : {144.0, 50.0}) {
+		simulated_heartbeat display(1);
+		auto& pll = *new vsync_pll;
+		pll.set_replaying(true);
+		pll.set_nominal_period(display.period, 0.01);
+		uint64_t wakeup;
+		for (uint x = 0; x < 20000; ++x) {
+			if (x == 5000)
+				display.period = 1e9 / Hz;
+			if (display.next(wakeup))
+				pll.new_value(wakeup);
+		}
+		check(pll.locked && std::abs(pll.period / display.period - 1) < 1e-4, "the loop didn't follow the mode change", Hz, pll.period, display.period);
+		delete &pll;
+	}
+	outc("pll after a mode change: it locks again");
+}
+
+//a wakeup most of a period late lands in the next frame, as an early error. the loop used to count those fully, and 1% of them set the phase 170 us early, 3% 490 us. now it moves them a frame back, as late ones
+void test_pll_discounts_very_late_wakeups() {
+	for (double chance : {0.01, 0.03})
+		for (uint64_t seed = 1; seed <= 3; ++seed) {
+			simulated_heartbeat display(seed);
+			display.skip_chance = 0;
+			display.late_chance = chance;
+			display.late_fraction = 0.9; //0.54-1.26 periods
+			auto& cascade = *new vsync_cascade<16, 256>;
+			cascade.set_estimator(pll_estimator);
+			cascade.set_replaying(true);
+			uint64_t wakeup;
+			double sum = 0, squares = 0;
+			uint count = 0;
+			for (uint x = 0; x < 40000; ++x) {
+				display.next(wakeup);
+				cascade.new_value(wakeup);
+				if (x > 3600) {
+					double error = display.prediction_error(cascade.latest);
+					sum += error;
+					squares += error * error;
+					++count;
+				}
+			}
+			double mean = sum / count, rms = std::sqrt(squares / count);
+			check(std::abs(mean) < 1e3 && rms < 2e3, "very late wakeups moved the loop", chance, seed, mean, rms);
+			delete &cascade;
+		}
+	outc("pll with wakeups a period late: the phase holds");
+}
+
+//the weighted L1 distance of the window's points above the line through frame f0 at timepoint t0, with period ticks per frame
+template <uint size> double l1_distance(vsync_finder<size>& finder, uint64_t t0, uint f0, double period) {
+	double sum = 0;
+	for (uint x = finder.index_begin; x != finder.index_end; ++x) {
+		double weight = finder.weighted() ? std::pow(finder.recency, finder.age_of(x)) : 1;
+		sum += weight * (double(int64_t(finder.timepoint_at(x) - t0)) - double(int(finder.frame_at(x) - f0)) * period);
+	}
+	return sum;
+}
+
+//the blocked hull must find the same line as the definition: of the lines through two points with every point on or above them, the one with the least L1 distance. that's O(size^3), so it's checked now and then.
+//	when the period grows, every point is on the hull, which is the case that used to walk it. bursts skip many vblanks, which gives the hull long gaps. the weighted runs move the pivots late in the window
+//	reference_verify_correctness() checks the pivots in debug builds. this checks the line itself, with NDEBUG too: a bridge that dropped its left point, or a pivot one hull point late, both failed here
+template <uint size> void check_hull_against_brute_force(vsync_finder<size>& finder) {
+	if (finder.elements() < 3)
+		return;
+	double best = INFINITY;
+	for (uint i = finder.index_begin; i != finder.index_end; ++i)
+		for (uint j = i + 1; j != finder.index_end; ++j) {
+			int64_t ticks = int64_t(finder.timepoint_at(j) - finder.timepoint_at(i));
+			int frames = int(finder.frame_at(j) - finder.frame_at(i));
+			bool under_every_point = true;
+			for (uint k = finder.index_begin; k != finder.index_end && under_every_point; ++k)
+				under_every_point = int64_t(finder.timepoint_at(k) - finder.timepoint_at(i)) * frames - ticks * int(finder.frame_at(k) - finder.frame_at(i)) >= 0;
+			if (under_every_point)
+				best = std::min(best, l1_distance(finder, finder.timepoint_at(i), finder.frame_at(i), double(ticks) / frames));
+		}
+	double found = l1_distance(finder, finder.timepoint_at(finder.middle_pivot), finder.frame_at(finder.middle_pivot), double(finder.period_numerator) / finder.period_denominator);
+	check(std::abs(found - best) <= 1e-9 * best + 1, "the hull's line isn't the least L1 line", size, finder.elements(), found, best);
+}
+
+template <uint size> void test_hull_matches_brute_force(double half_life) {
+	for (int trace = 0; trace < 3; ++trace)
+		for (uint64_t seed = 1; seed <= 2; ++seed) {
+			simulated_heartbeat display(seed);
+			if (trace == 1) { //convex: no noise, and a period that grows, so every point is on the hull
+				display.drift = 1e-3;
+				display.skip_chance = display.late_chance = 0;
+			}
+			if (trace == 2) //bursts
+				display.skip_chance = 0.5;
+			auto& finder = *new vsync_finder<size>;
+			finder.set_replaying(true);
+			finder.set_recency_half_life(half_life);
+			uint64_t wakeup;
+			for (uint x = 0; x < 4000; ++x) {
+				if (trace == 1)
+					display.next(wakeup), wakeup = display.ticks(display.vblank);
+				else if (!display.next(wakeup))
+					continue;
+				finder.new_value(wakeup);
+				if (x % (size * 2 + 7) == 0)
+					check_hull_against_brute_force(finder);
+			}
+			check_hull_against_brute_force(finder);
+			delete &finder;
+		}
+}
+
+void test_hull_is_least_l1() {
+	test_hull_matches_brute_force<4>(0);
+	test_hull_matches_brute_force<32>(0);
+	test_hull_matches_brute_force<256>(0);
+	test_hull_matches_brute_force<256>(64);
+	outc("blocked hull: the same line as the brute-force L1 search");
+}
+
+//frames from the start, or from a mode change, until finder's prediction stays within bound for 30 estimates in a row. -1 if it never does
+template <class finder_type> int frames_to_lock(uint64_t seed, double Hz, double bound) {
+	simulated_heartbeat display(seed);
+	display.late_chance = 0;
+	auto& finder = *new finder_type;
+	finder.set_replaying(true);
+	uint change = Hz ? 3000 : 0, in_a_row = 0;
+	int locked = -1;
+	uint64_t wakeup;
+	for (uint x = 0; x < change + 3000; ++x) {
+		if (Hz && x == change)
+			display.period = 1e9 / Hz;
+		if (!display.next(wakeup))
+			continue;
+		finder.new_value(wakeup);
+		if (x < change || finder.latest.period == 0)
+			continue;
+		if (std::abs(display.prediction_error(finder.latest)) >= bound)
+			in_a_row = 0, locked = -1;
+		else if (++in_a_row == 30 && locked < 0)
+			locked = int(x - change) - 29;
+	}
+	delete &finder;
+	return locked;
+}
+
+//the cascade's short finder is there to lock fast, and it must lock at least as fast as the long finder alone. within 50 us, over 10 seeds:
+//	at the start, both locked in 7.1 frames on average. a long finder that's filling is a short one
+//	after 59.94 Hz to 59.97, 60, or 59.9 Hz, the long one restarts, and it's a short one again: 8.2, 28.3, and 28 frames alone, and 8.2, 27.4, 28 in the cascade
+//	when the restart handover faded from the stale phase whatever its size, 60 Hz took 34.1 frames in the cascade
+//the cascade is ahead where the long finder lags without restarting: at 59.95 Hz, its worst error was 37 us against 43 us alone
+void test_cascade_locks_fast() {
+	for (double Hz : {0.0, 59.97, 60.0, 59.9}) {
+		int cascade = 0, alone = 0, worst = 0;
+		for (uint64_t seed = 1; seed <= 10; ++seed) {
+			int c = frames_to_lock<vsync_cascade<16, 256>>(seed, Hz, 50e3), a = frames_to_lock<vsync_hypotheses<256>>(seed, Hz, 50e3);
+			check(c >= 0 && a >= 0, "never locked", Hz, seed, c, a);
+			cascade += c;
+			alone += a;
+			worst = std::max(worst, c);
+		}
+		check(cascade <= alone && worst < 64, "the cascade locked slower than the long finder alone", Hz, cascade / 10.0, alone / 10.0, worst);
+		outc("time to lock within 50 us", Hz ? "after a mode change to" : "from the start", Hz ? Hz : 59.94, "Hz: cascade", cascade / 10.0, "frames, long finder alone", alone / 10.0, ", worst", worst);
+	}
+}
+
+//the display drifts 1 ppm/s, and the drift filter must read it, through a mode change too. 59.94 Hz to 60 Hz is under the filter's max_jump, and it used to take the step for drift:
+//	it read 0.93 ppm/s, and bent the phase 28-40 us early for a minute after the change. now the step is far from the trend by the samples' scatter, and the filter starts over
+void test_drift_filter_reads_drift() {
+	for (double Hz : {0.0, 60.0})
+		for (uint64_t seed = 1; seed <= 3; ++seed) {
+			simulated_heartbeat display(seed);
+			auto& cascade = *new vsync_cascade<16, 256>;
+			cascade.set_replaying(true);
+			uint64_t wakeup;
+			double sum = 0;
+			uint count = 0;
+			for (uint x = 0; x < 40000; ++x) {
+				if (Hz && x == 3000)
+					display.period = 1e9 / Hz;
+				if (display.next(wakeup))
+					cascade.new_value(wakeup);
+				if (x >= 3300 && x < 9000) {
+					sum += display.prediction_error(cascade.latest);
+					++count;
+				}
+			}
+			double mean = sum / count;
+			check(std::abs(cascade.latest.drift - 1) < 0.05 && std::abs(mean) < 2e3, "the drift filter misread the drift", Hz, seed, cascade.latest.drift, mean);
+			delete &cascade;
+		}
+	outc("drift filter at 1 ppm/s: it reads 1 ppm/s, and a mode change doesn't bend it");
+}
+
+//the regressions divide by the window's total weight. it's 0 in an empty window, and robust can bring it close: judging stops below 3 points with weight, which is all that keeps it from 0.
+//the regression used to divide by it anyway, and publish a NaN phase and period. now it keeps the previous ones
+void test_scanline_without_weight() {
+	for (auto shape : {vscan::rectangular_window, vscan::exponential_window}) {
+		simulated_heartbeat display(1);
+		vscan::set_window(shape);
+		vscan::replaying = true;
+		double time = 0;
+		for (uint x = 0; x < 1000; ++x) {
+			time += display.period * (0.8 + 0.4 * display.unit());
+			while (display.vblank + display.period <= time)
+				display.vblank += display.period;
+			uint scanline = uint((time - display.vblank) / display.period * total_scanlines);
+			vscan::new_value(display.ticks(time + 3e3 * std::normal_distribution<double>(0, 1)(display.random)), scanline);
+		}
+		vblank_estimate before = vscan::latest;
+		vscan::set_window(shape); //empties the window
+		if (shape == vscan::rectangular_window)
+			vscan::linear_regression();
+		else
+			vscan::exponential.regression();
+		check(vscan::latest.phase == before.phase && vscan::latest.period == before.period, "vscan regressed an empty window", int(shape), vscan::latest.period);
+		vscan::replaying = false;
+	}
+	outc("scanline window without weight: the estimate holds");
+}
+
+//the spread of the fused phase around its mean, with the sources that are fed. the sources sit on different edges of the vblank, so the spread is what matters, like the jitter of a tearline.
+//every source is simulated whether it's fed or not, so every combination sees the same trace
+double fused_spread(bool use_vf, bool use_vscan, bool use_oml) {
+	simulated_heartbeat display(1);
+	std::normal_distribution<double> normal(0, 1);
+	auto& fused = *new vblank_fusion;
+	fused.replaying = true;
+	auto& finder = *new vsync_cascade<16, 256>;
+	finder.set_replaying(true);
+	vscan::scanline_noise_variance = 1.0 / 12 + 0.5 * 0.5;
+	vscan::set_window(vscan::window);
+	vscan::replaying = true;
+	uint64_t previous_oml = 0;
+	double sum = 0, squares = 0;
+	uint count = 0;
+	for (uint x = 0; x < 40000; ++x) {
+		uint64_t wakeup;
+		bool woke = display.next(wakeup);
+		uint64_t oml = display.ticks(std::floor((display.vblank + 300 * normal(display.random)) / 1000) * 1000);
+		double time = display.vblank + display.period * display.unit();
+		double line = (time - display.vblank) / display.period * total_scanlines + 0.5 * normal(display.random);
+		uint64_t read = display.ticks(time + 3e3 * normal(display.random));
+		if (use_vf && woke) {
+			finder.new_value(wakeup);
+			fused.add(source_vf, finder.latest);
+		}
+		if (use_oml) //like counter_to_estimate(): one vblank, with the period of one frame
+			fused.add(source_oml, {.phase = oml, .period = previous_oml ? double(int64_t(oml - previous_oml)) : 0, .generation = x + 1});
+		previous_oml = oml;
+		if (use_vscan) {
+			vscan::new_value(read, uint(std::clamp(line, 0.0, total_scanlines - 1.0)));
+			fused.add(source_vscan, vscan::latest);
+		}
+		if (x >= 15000 && fused.latest.period > 0) { //OML takes over as the reference after 4096 measurements, and the offsets settle after that
+			uint64_t truth = display.ticks(display.vblank + display.period);
+			double error = double(int64_t(extrapolate_estimate(fused.latest, truth).phase - truth));
+			sum += error;
+			squares += error * error;
+			++count;
+		}
+	}
+	vscan::replaying = false;
+	delete &finder;
+	delete &fused;
+	check(count > 0, "the fusion never published", use_vf, use_vscan, use_oml);
+	return std::sqrt(squares / count - (sum / count) * (sum / count));
+}
+
+//fusing must never be worse than the best source alone. OML is quantized to 1 us, far better than vf and vscan, and letting their wander in made the fused phase worse than OML's.
+//	and OML's period of one frame, taken as a fresh measurement, counted its error twice: OML alone wandered off by 5 ms
+void test_fusion_beats_best_source() {
+	double vf = fused_spread(true, false, false);
+	double vscan = fused_spread(false, true, false);
+	double oml = fused_spread(false, false, true);
+	double all = fused_spread(true, true, true);
+	double vf_vscan = fused_spread(true, true, false);
+	check(oml < 100, "OML through the filter wandered off", oml);
+	check(all <= oml * 1.01, "fusing all three was worse than OML alone", all, oml);
+	check(vf_vscan <= std::min(vf, vscan), "fusing vf and vscan was worse than the better of them", vf_vscan, vf, vscan);
+	outc("fusion: all three", all, "ns against OML's", oml, "ns, vf and vscan", vf_vscan, "ns against", vf, "and", vscan, "ns");
+}
+
+//a mode change from 59.94 Hz to 59.95 Hz, with vf and vscan. the filter's model has no room for a period step, so it only saw innovations, learned them as noise, and opened its gate.
+//	it kept the old period behind vf, which was served alone while vscan was left out, and when vscan came back in, the phase was 8 ms off
+void test_fusion_follows_mode_change() {
+	for (uint64_t seed = 1; seed <= 3; ++seed) {
+		simulated_heartbeat display(seed);
+		display.late_chance = 0;
+		std::normal_distribution<double> normal(0, 1);
+		auto& fused = *new vblank_fusion;
+		fused.replaying = true;
+		auto& finder = *new vsync_cascade<16, 256>;
+		finder.set_replaying(true);
+		vscan::scanline_noise_variance = 1.0 / 12 + 0.5 * 0.5;
+		vscan::set_window(vscan::window);
+		vscan::replaying = true;
+		double before = 0; //the fused phase's mean distance from the vblank, which sits on the reference's edge
+		double worst = 0;
+		for (uint x = 0; x < 12000; ++x) {
+			if (x == 5000)
+				display.period = 1e9 / 59.95;
+			uint64_t wakeup;
+			if (display.next(wakeup)) {
+				finder.new_value(wakeup);
+				fused.add(source_vf, finder.latest);
+			}
+			double time = display.vblank + display.period * display.unit();
+			double line = (time - display.vblank) / display.period * total_scanlines + 0.5 * normal(display.random);
+			vscan::new_value(display.ticks(time + 3e3 * normal(display.random)), uint(std::clamp(line, 0.0, total_scanlines - 1.0)));
+			fused.add(source_vscan, vscan::latest);
+			uint64_t truth = display.ticks(display.vblank + display.period);
+			double error = std::remainder(double(int64_t(extrapolate_estimate(fused.latest, truth).phase - truth)), display.period);
+			if (x >= 3000 && x < 5000)
+				before += error / 2000;
+			if (x >= 7000)
+				worst = std::max(worst, std::abs(error - before));
+		}
+		vscan::replaying = false;
+		delete &finder;
+		delete &fused;
+		check(worst < 100e3, "the fusion lost the vblank after a mode change", seed, worst);
+	}
+	outc("fusion after a mode change: the phase holds");
+}
+
+int main() {
+	setvbuf(stdout, nullptr, _IONBF, 0); //check() traps without flushing, and the failure's message would be lost
+	test_hull_is_least_l1();
+	test_frame_shift_keeps_window();
+	test_event_ring_counts();
+	test_vscan_sums_exact();
+	test_vscan_quarantines_ambiguous_point();
+	test_no_nominal_keeps_period();
+	test_cascade_ignores_lateness_ramp();
+	test_pll_locks_without_nominal();
+	test_pll_follows_mode_change();
+	test_pll_discounts_very_late_wakeups();
+	test_drift_filter_reads_drift();
+	test_cascade_locks_fast();
+	test_scanline_without_weight();
+	test_fusion_beats_best_source();
+	test_fusion_follows_mode_change();
+	outc("all passed");
+}
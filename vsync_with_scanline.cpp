@@ -1,10 +1,14 @@
 #pragma once
 #include "console.h"
 #include "div_floor.h"
+#include "period_drift.h"
 #include "timing.h"
+#include "vblank_estimate.h"
+#include "vsync_events.cpp"
 #include <array>
 #include <atomic>
 #include <cmath>
+#include <span>
 
 extern double system_claimed_monitor_Hz; //may not be totally accurate. however, we assume it should be good enough. get this from system API
 extern int total_scanlines; //we assume these are swept through at an even rate. get this from the system API
@@ -13,26 +17,169 @@ extern int total_scanlines; //we assume these are swept through at an even rate.
 namespace vscan {
 uint64_t phase;
 double period;
+double drift; //ppm per second, see period_drift_filter
+vblank_estimate latest; //the writer's side. phase and period are published from it, except during a replay
+uint64_t estimates_published = 0;
+bool replaying = false; //see new_values()
 
-constexpr uint max_size = 64; //our function is O(1). the only tradeoff is space. so we might as well bump the size up even though it barely improves accuracy.
+//which variable the regression treats as noisy. see linear_regression()
+enum regression_mode {
+	time_on_scanline, //scanline is the independent variable, and all the noise is in the time. the original
+	scanline_on_time, //inverse regression: time is the independent variable, and all the noise is in the scanline
+	errors_in_variables, //time on scanline, with the slope corrected for the scanline's known noise variance
+};
+//measured with vsync_benchmark.cpp at 59.94 Hz, 1 ppm/s drift and 3 us of timepoint jitter. phase rms / mean, time_on_scanline, scanline_on_time, errors_in_variables:
+//	60 fps, 0.5 scanlines of jitter: 1.93 / -1.55, 1.87 / -1.52, 1.90 / -1.54 us. the same within noise. the mean is the drift, which vscan doesn't correct
+//	2000 fps, 5 scanlines: 10.5 / -0.60, 9.7 / 0.12, 10.2 / 0.17 us. the window spans 8 frames, and the jitter attenuates time_on_scanline's slope
+//so scanline_on_time is the default. it's never worse, and errors_in_variables needs the readout's jitter in scanline_noise_variance, which you usually don't know. its own bias is from the timepoint's noise, and 3 us is a fifth of a scanline
+regression_mode mode = scanline_on_time;
+double scanline_noise_variance = 1.0 / 12; //scanlines^2, for errors_in_variables. the report is floor(scanline), which is uniform noise of variance 1/12. if you know the readout's jitter, add its variance here
+period_drift_filter drift_filter; //fed by full windows. the regression line's period belongs to the window's average time
+
+//some GPUs read the scanline slowly (8 scanlines on a 1080 Ti), or the read sticks during the porch. one bad read used to drag the least-squares line for a whole window.
+//with robust on, each point gets a Huber weight when it arrives: 1 if its residual from the current line is within huber_k robust scales, and huber_k * scale / residual beyond that.
+//	the weight is fixed once it's given, so it's one step of iteratively reweighted least squares per point, and the sums stay O(1). a full IRLS pass over the window would reweigh old points too, but they were judged against a line that was just as good.
+//	weights are integers out of weight_one, so the sums stay exact. a weight under 1/32 rounds to 0, so a wildly wrong read is thrown out entirely.
+//the scale is a lowpass of the absolute residuals, each capped at 3 scales so an outlier can't inflate it. if the line really moved, every point is an outlier, and the cap lets the scale grow by 1/8 per point until they fit again.
+//simulated at 1080p 60 Hz with 0.5 scanlines of jitter, phase rms without / with robust: clean reads 1.17 / 1.16 us. 2% of reads 8-48 scanlines late: 11.7 / 1.2 us. 10% late: 44.9 / 3.1 us.
+//	reads stuck at the start of the porch: 14.1 / 1.5 us. it costs ~0.02 us per point.
+bool robust = true;
+double huber_k = 2.0; //in units of the scale, which is the average absolute residual. 2 average absolute residuals is 1.6 standard deviations of a normal distribution
+constexpr int weight_one = 16;
+constexpr uint robust_after = 8; //the line from fewer points is too rough to judge residuals with. they get full weight
+constexpr double scale_rate = 1.0 / 16;
+double residual_scale = 0; //ticks
+
+constexpr uint max_size = 256; //our function is O(1). the only tradeoff is space. so we might as well bump the size up even though it barely improves accuracy.
+//it used to be 64, which was as far as the wrapping 64-bit sums could go. the centered 128-bit sums below go past 4096.
 
 namespace circular {
 uint64_t timepoints[max_size] = {}; //first element is calculated off the previous. so initialize them all to a indeterminate value (which is 0)
 unsigned scanline[max_size] = {};
 unsigned frame_of[max_size] = {};
+int weight[max_size] = {}; //out of weight_one. see robust
 } // namespace circular
 uint index_end = 0;
 uint index_begin = 0;
 uint64_t& timepoint_at(uint x) { return circular::timepoints[x % max_size]; }
 uint& scanline_at(uint x) { return circular::scanline[x % max_size]; }
 uint& frame_at(uint x) { return circular::frame_of[x % max_size]; }
-uint64_t sum_of_timepoints = 0;
-uint64_t sum_of_unwrapped_scanlines = 0; //unwrapped scanline = each scanline has frame * total_scanlines already added to it. must be uint64_t so that it is wrap is consistent with the others. it gets added and multiplied
-uint64_t sum_timepoint_timepoint = 0; //sum of squares of timepoints. will be used for error calculation (if I ever figure out how to do it)
-uint64_t sum_timepoint_scanline = 0; //sum of timepoints * unwrapped scanlines
-uint64_t sum_scanline_scanline = 0; //sum of squares of unwrapped scanlines.
+int& weight_at(uint x) { return circular::weight[x % max_size]; }
 uint elements() { return index_end - index_begin; }
 
+//the sums used to be of absolute timepoints and their squares, mod 2^64. the slope survived the wrapping, but the squares of nanosecond timepoints wrap almost immediately, so the error was garbage.
+//now the sums are of t = timepoint - origin_timepoint and s = unwrapped scanline, counted from the start of origin_frame. unwrapped scanline = each scanline has frame * total_scanlines added to it.
+//the origin is the oldest point in the window, and it moves whenever that point expires. so t and s span one window, and every sum is an exact integer:
+//	|t| < 2^40 (18 minutes), |s| < 2^32, and the weights are at most 2^4. W * weighted sum of squares < (2^4 n)^2 * 2^80, which fits in 128 bits up to n = 2^19.
+//every sum is weighted, and W = sum_w is the total weight. without robust, every weight is weight_one, and the weights cancel out of every result.
+uint64_t origin_timepoint = 0;
+uint origin_frame = 0;
+int64_t t_at(uint x) { return int64_t(timepoint_at(x) - origin_timepoint); }
+int64_t s_at(uint x) { return int64_t(int(frame_at(x) - origin_frame)) * total_scanlines + scanline_at(x); }
+int128 sum_w = 0;
+int128 sum_t = 0;
+int128 sum_s = 0;
+int128 sum_tt = 0;
+int128 sum_ts = 0;
+int128 sum_ss = 0;
+
+double to_double(int128 x) { return double(int64_t(x >> 32)) * 4294967296.0 + double(uint32_t(x)); } //MSVC's int128 doesn't convert to double
+
+uint weighted_elements = 0; //points with a nonzero weight
+
+void add_to_sums(uint x, int sign) {
+	int128 t = t_at(x), s = s_at(x);
+	int128 w = sign * weight_at(x);
+	sum_w += w;
+	sum_t += w * t;
+	sum_s += w * s;
+	sum_tt += w * t * t;
+	sum_ts += w * t * s;
+	sum_ss += w * s * s;
+	weighted_elements += sign * (weight_at(x) != 0);
+}
+
+//moves the origin to the point at index. the sums are shifted exactly: sum w (t - dt)^2 = sum w t^2 - 2 dt sum w t + W dt^2, and so on.
+void move_origin(uint index) {
+	int128 dt = t_at(index), ds = s_at(index) - scanline_at(index); //the origin is the start of the point's frame, not the point's scanline
+	int128 n = sum_w;
+	sum_tt += n * dt * dt - 2 * dt * sum_t;
+	sum_ts += n * dt * ds - dt * sum_s - ds * sum_t;
+	sum_ss += n * ds * ds - 2 * ds * sum_s;
+	sum_t -= n * dt;
+	sum_s -= n * ds;
+	origin_timepoint = timepoint_at(index);
+	origin_frame = frame_at(index);
+}
+
+//W^2 times the weighted covariances. they're exact, since they're differences of exact sums
+int128 covariance_ts() { return sum_w * sum_ts - sum_t * sum_s; }
+int128 covariance_tt() { return sum_w * sum_tt - sum_t * sum_t; }
+int128 covariance_ss() { return sum_w * sum_ss - sum_s * sum_s; }
+
+//standard deviation of the timepoints around the regression line, in ticks. 0 with 2 points or fewer, which the line always fits.
+//shortcut formula.
+//https://www.cs.wustl.edu/~jain/iucee/ftp/k_14slr.pdf
+//https://www.colorado.edu/amath/sites/default/files/attached-files/ch12_0.pdf
+//SSE = sum ((ti - t_) - b (si - s_))^2 = sum (ti - t_)^2 - 2b sum (si - s_)(ti - t_) + b^2 sum (si - s_)^2. it holds for any line through the averages, so for every regression_mode.
+//	the centered sums are exact, so the only rounding is in the final subtraction.
+//	it cancels most of the digits, since the line explains nearly all of the timepoints' spread. doubles keep 16 digits, and a window of 256 points at 60 Hz loses 11 of them, so the error still has 5.
+double standard_error(double accurate_ticks_per_scanline) {
+	if (elements() <= 2)
+		return 0;
+	double b = accurate_ticks_per_scanline;
+	double W = to_double(sum_w);
+	double SSE = (to_double(covariance_tt()) - 2 * b * to_double(covariance_ts()) + b * b * to_double(covariance_ss())) / W; //the covariances are W times the centered sums. this is the weighted SSE
+	return std::sqrt(std::max(SSE, 0.0) / W * elements() / (elements() - 2));
+}
+
+double ticks_per_scanline = 0; //slope of the last regression line. huber_weight() judges new points with it
+
+//new_value() places each scanline in a frame by counting how many periods passed since the previous point. it used to count with system_claimed_monitor_Hz, which is glfw's integer rate.
+//	on a 59.94 Hz panel, that's 0.1% off, so after a 500-frame gap (a minimized window), the count was a frame off, and the regression bent around the wrong frame for a whole window.
+//now it counts with the measured period, and the claimed rate is only a fallback until there is one. the count is trusted only if it's clear of the halfway point between two frames by the count's uncertainty.
+//	the uncertainty is the period's standard error times the frames elapsed, plus the line's error, in unwrap_sigmas. a point that fails is quarantined: left out, like a scanline that was never read.
+//	if quarantine_limit points in a row fail, the gap lost the frame count for good. the window restarts, and numbers frames from the new point.
+//simulated with 3 us of jitter and a 2000-frame gap every 3000 points, phase rms before / after: 59.94 Hz claimed as 59, 1.12 ms / 0.68 us. 143.9 Hz claimed as 144, 131 / 0.46 us.
+//	with 1 ms of jitter, the line's error makes 0.06% of points ambiguous. quarantining them takes the rms from 1.45 to 0.63 ms.
+double unwrap_period = 0; //ticks. 0 until a regression measured it. kept through restarts, since the display didn't change
+double unwrap_period_error = 0; //ticks, one standard error of unwrap_period
+constexpr uint unwrap_trusted_after = 16; //points. a shorter window's period is too rough, even with its standard error
+double unwrap_sigmas = 4;
+double claimed_rate_error = 0.002; //relative, for the fallback. the modeline's rate is exact, but glfw's integer rate is 0.1% off at 59.94 Hz
+constexpr uint quarantine_limit = 4;
+uint quarantined_in_a_row = 0;
+
+void set_unwrap_period(double period, double error) {
+	if (!std::isfinite(error) || period <= 0)
+		return;
+	unwrap_period = period;
+	unwrap_period_error = error;
+}
+
+//the slope for the selected regression_mode, in ticks per scanline. tt, ts, ss are the centered sums, all multiplied by the same factor. noise is the scanline's noise variance, multiplied by the factor of ss
+double regression_slope(double tt, double ts, double ss, double noise) {
+	if (mode == scanline_on_time && ts != 0)
+		return tt / ts;
+	if (mode == errors_in_variables && ss > 2 * noise) //otherwise the window is mostly noise, and the correction would blow up
+		return ts / (ss - noise);
+	return ts / ss;
+}
+
+//residual: how far a new point is from the current line, in ticks
+int huber_weight(double residual) {
+	residual = std::abs(residual);
+	if (residual_scale <= 0) {
+		residual_scale = residual;
+		return weight_one;
+	}
+	double limit = huber_k * residual_scale;
+	residual_scale += (std::min(residual, 3 * residual_scale) - residual_scale) * scale_rate;
+	if (residual <= limit)
+		return weight_one;
+	return int(std::lround(weight_one * limit / residual));
+}
+
 void linear_regression() {
 	//time for linear regression. what should the dependent and independent variables be?
 	//there is noise in both the timepoint and scanline measurement.
@@ -49,73 +196,255 @@ void linear_regression() {
 	//https://en.wikipedia.org/wiki/Simple_linear_regression
 	//https://math.stackexchange.com/questions/2826957/simplifying-beta-1-estimate-for-a-simple-linear-regression-model
 	//https://www.cs.wustl.edu/~jain/iucee/ftp/k_14slr.pdf page 8
-	//we are operating mod 2^64. so n average(x) average(y) will cause a problem. because division is not a function (it's multivalued). without division, we cannot take averages
-	//to solve this, multiply by the number of elements, which will eliminate the division.
+	//multiply by the number of elements, which eliminates the division in the averages.
 	//our formula is (n sum (x_i y_i) - n^2 x_y_) / (n sum (x_i^2) - n^2 x_^2) =
-	//(n sum (x_i y_i) - sum_x sum_y) / (n sum (x_i^2) - sum_x sum_x)
-	uint64_t numerator = elements() * sum_timepoint_scanline - sum_of_timepoints * sum_of_unwrapped_scanlines;
-	uint64_t denominator = elements() * sum_scanline_scanline - sum_of_unwrapped_scanlines * sum_of_unwrapped_scanlines;
-	double accurate_ticks_per_scanline = double(numerator) / denominator; //slope of regression line
+	//(n sum (x_i y_i) - sum_t sum_s) / (n sum (x_i^2) - sum_t sum_t)
+	//x_i is the scanline and y_i is the timepoint.
+	//all three modes come from the same sums, so switching is free, and all three lines go through the averages. only the slope differs:
+	//	time_on_scanline: cov(s, t) / var(s). noise in the scanline pulls the slope toward 0 by var(noise) / var(s). that's attenuation bias.
+	//	scanline_on_time: var(t) / cov(s, t). noise in the timepoint pushes the slope away from 0 instead, by var(timepoint noise) / var(t).
+	//	errors_in_variables: cov(s, t) / (var(s) - var(noise)). the method of moments: it removes the attenuation exactly, if the noise variance is known.
+	//unwrapping makes var(s) large, so the attenuation is usually tiny: at 60 fps, a window spans 256 frames, and var(s) ~ 7e9 scanlines^2.
+	//	it grows when the renderer runs fast, since the window then spans only a few frames, and it grows with the readout's jitter. the phase is extrapolated half a window past the average, so the slope's bias lands on it.
+	//simulated at 1080p 60 Hz, with 0.003 ms of timepoint jitter, phase bias of time_on_scanline / scanline_on_time / errors_in_variables:
+	//	60 fps, 0.5 scanlines of readout jitter: -18 / -18 / -18 ns. all three are the same.
+	//	2000 fps, 0.5 scanlines: -7 / -3 / -3 ns.
+	//	2000 fps, 5 scanlines (the window spans 8 frames): -353 / -63 / -61 ns. the rms error is 0.0102 ms for all three, so the bias is the only difference.
+	//so the todo above was right, but it only matters at high frame rates with a jittery readout. errors_in_variables needs scanline_noise_variance to include that jitter.
+
+	//an empty window has no weight, and robust can bring a full one down to 3 points with weight, or their weights down to the last few. judging stops below 3, which is all that keeps it from 0. the points with weight can also share a scanline.
+	//	then there's no line, and the averages and the slope divide by zero, and publish NaN. keep the previous phase and period, until points with weight come in.
+	if (sum_w <= 0 || covariance_ss() <= 0)
+		return;
+	double noise = scanline_noise_variance * to_double(sum_w) * to_double(sum_w); //the covariances are W^2 times the variances
+	double accurate_ticks_per_scanline = regression_slope(to_double(covariance_tt()), to_double(covariance_ts()), to_double(covariance_ss()), noise); //slope of regression line
 
-	//after calculating the slope, we must calculate phase. however, we must place the origin at an existing timepoint. (we'd have precision issues if we placed the origin at 0.) we choose index_begin to be the origin.
-	uint64_t unwrapped_scanline = frame_at(index_begin) * total_scanlines + scanline_at(index_begin);
-	double scanline_average = (sum_of_unwrapped_scanlines - elements() * unwrapped_scanline) / double(elements());
-	double timepoint_average = (sum_of_timepoints - elements() * timepoint_at(index_begin)) / double(elements());
-	//x-axis: zero is the scanline associated to index_begin()
-	//y-axis: zero is the timepoint associated to index_begin()
+	//x-axis: zero is the start of origin_frame
+	//y-axis: zero is origin_timepoint
+	double scanline_average = to_double(sum_s) / to_double(sum_w);
+	double timepoint_average = to_double(sum_t) / to_double(sum_w);
 
-	double estimated_timepoint_at_index_vblank = timepoint_average - accurate_ticks_per_scanline * (scanline_average + scanline_at(index_begin)); //best guess for the timepoint of the vblank associated to index_begin())
+	double estimated_timepoint_at_origin_vblank = timepoint_average - accurate_ticks_per_scanline * scanline_average; //best guess for the timepoint of the vblank of origin_frame
 
-	double phase_offset_from_estimated_vblank = (frame_at(index_end - 1) - frame_at(index_begin) + 1) * total_scanlines * accurate_ticks_per_scanline;
+	double phase_offset_from_estimated_vblank = int(frame_at(index_end - 1) - origin_frame + 1) * total_scanlines * accurate_ticks_per_scanline;
 	double adjustment_for_floor_operation = -0.5 * accurate_ticks_per_scanline; //the scanline report is N for scanline [N, N+1). so subtract half a scanline
-	phase = int64_t(phase_offset_from_estimated_vblank + estimated_timepoint_at_index_vblank + adjustment_for_floor_operation) + timepoint_at(index_begin);
-	//outc("new phase", phase, accurate_ticks_per_scanline * total_scanlines, "backup estimate", timepoint_at(index_end - 1) - double(scanline_at(index_end - 1)) / total_scanlines * ticks_per_sec / 60 + ticks_per_sec / 60);
-	period = accurate_ticks_per_scanline * total_scanlines;
+	latest.phase = int64_t(phase_offset_from_estimated_vblank + estimated_timepoint_at_origin_vblank + adjustment_for_floor_operation) + origin_timepoint;
+	//outc("new phase", latest.phase, accurate_ticks_per_scanline * total_scanlines, "backup estimate", timepoint_at(index_end - 1) - double(scanline_at(index_end - 1)) / total_scanlines * ticks_per_sec / 60 + ticks_per_sec / 60);
+	latest.period = accurate_ticks_per_scanline * total_scanlines;
+	latest.error = standard_error(accurate_ticks_per_scanline);
+	ticks_per_scanline = accurate_ticks_per_scanline;
+	if (elements() >= unwrap_trusted_after) //the standard error of the slope is error / sqrt(sum of squared scanline deviations). covariance_ss is W times that sum, in weights of weight_one
+		set_unwrap_period(latest.period, latest.error / std::sqrt(to_double(covariance_ss()) / to_double(sum_w) / weight_one) * total_scanlines);
+	if (elements() == max_size)
+		drift_filter.add(origin_timepoint + int64_t(timepoint_average), latest.period);
+	latest.drift = drift_filter.drift();
+}
+
+//the rectangular window keeps max_size points only so that it can subtract them out of its sums again, and drift makes them fall off a cliff when they do.
+//the exponential window forgets by decaying its sums instead. it's recursive least squares with a forgetting factor, so it needs no buffer, and old points fade out smoothly.
+//it's written as weighted moments with West's update, like period_drift_filter. the centered moments don't depend on the origin, so only the averages move when the origin does.
+//it's in doubles, not exact integers, since decay makes every sum fractional anyway. the moments are centered, so nothing cancels in them.
+struct exponential_sums {
+	double half_life = 64; //points. the average point is then 92 points old, against 128 in the 256-point rectangular window
+	uint64_t points = 0; //since the last reset
+	double weight = 0;
+	double mean_t = 0, mean_s = 0; //ticks after origin_timepoint, and scanlines after the start of origin_frame
+	double moment_tt = 0, moment_ts = 0, moment_ss = 0; //weighted sums of the products of the deviations from the averages
+	uint64_t origin_timepoint = 0; //the newest point. the averages are relative to it
+	uint origin_frame = 0;
+	uint newest_scanline = 0;
+
+	double slope() { return regression_slope(moment_tt, moment_ts, moment_ss, scanline_noise_variance * weight); }
+
+	//the new point's distance from the current line, in ticks
+	double residual(uint64_t timepoint, uint frame, uint scanline) {
+		double t = double(int64_t(timepoint - origin_timepoint));
+		double s = double(int(frame - origin_frame)) * total_scanlines + scanline;
+		return t - mean_t - ticks_per_scanline * (s - mean_s);
+	}
+
+	void add(uint64_t timepoint, uint frame, uint scanline, int point_weight) {
+		if (points != 0) { //move the origin to the new point
+			mean_t -= double(int64_t(timepoint - origin_timepoint));
+			mean_s -= double(int(frame - origin_frame)) * total_scanlines;
+		}
+		origin_timepoint = timepoint;
+		origin_frame = frame;
+		newest_scanline = scanline;
+		++points;
+		double w = double(point_weight) / weight_one;
+		double decay = std::exp2(-1 / half_life);
+		weight = weight * decay + w;
+		moment_tt *= decay;
+		moment_ts *= decay;
+		moment_ss *= decay;
+		if (w == 0) //a point robust threw out only ages the others. after enough of them, weight underflows to 0, and the update below would be 0 / 0
+			return;
+		double t_difference = 0 - mean_t;
+		double s_difference = scanline - mean_s;
+		mean_t += w * t_difference / weight;
+		mean_s += w * s_difference / weight;
+		moment_tt += w * t_difference * (0 - mean_t);
+		moment_ts += w * t_difference * (scanline - mean_s);
+		moment_ss += w * s_difference * (scanline - mean_s);
+	}
+
+	void regression() {
+		if (weight <= 0 || moment_ss <= 0) //no weight left, or no spread in the scanlines. see linear_regression(): the previous phase and period stay
+			return;
+		double b = slope();
+		double adjustment_for_floor_operation = -0.5 * b; //the scanline report is N for scanline [N, N+1). so subtract half a scanline
+		double phase = mean_t + b * (total_scanlines - mean_s) + adjustment_for_floor_operation; //the vblank after the newest point's frame
+		double period = b * total_scanlines;
+		latest.error = std::sqrt(std::max(moment_tt - 2 * b * moment_ts + b * b * moment_ss, 0.0) / weight); //see standard_error()
+		ticks_per_scanline = b;
+		if (points >= uint64_t(4 * half_life)) //it has forgotten how it started
+			drift_filter.add(origin_timepoint + int64_t(mean_t), period);
+		if (points >= unwrap_trusted_after)
+			set_unwrap_period(period, latest.error / std::sqrt(moment_ss) * total_scanlines);
+
+		//with drift, the points lie on a parabola, t = line + c * x^2, where x is in frames and c = rate * period^2 / 2. like vf's finder, correct the line for it.
+		//exponential weights are a long tail, so the line sits further from the end of the parabola than the chord of a rectangular window does.
+		//if the ages are exponential with mean m frames, fitting x^2 with a line leaves c * (F^2 + 4mF + 2m^2) at F frames after the newest point, and the slope is 2c(F + 2m) short.
+		//at 1 ppm/s and a half-life of 64 points at 60 fps, this takes the bias from -2.5 us to -0.15 us. the rectangular window of 256 has -1.6 us, since vscan never corrected it
+		double drift = drift_filter.drift();
+		double rate = drift * 1e-6 / ticks_per_sec;
+		double c = rate * period * period / 2;
+		double m = (newest_scanline - mean_s) / total_scanlines;
+		double F = double(total_scanlines - newest_scanline) / total_scanlines;
+		phase += c * (F * F + 4 * m * F + 2 * m * m);
+		period += 2 * c * (F + 2 * m);
+		latest.phase = origin_timepoint + int64_t(phase);
+		latest.period = period;
+		latest.drift = drift;
+	}
+
+	void reset() { *this = {.half_life = half_life}; }
+};
+exponential_sums exponential;
+
+enum window_shape {
+	rectangular_window, //the last max_size points, each with the same weight
+	exponential_window, //every point ever, with weights that halve every exponential.half_life points
+};
+window_shape window = rectangular_window;
+
+//the previous point, for unwrapping the scanlines. every window shape needs it
+uint64_t previous_timepoint = 0;
+uint previous_scanline = 0;
+uint previous_frame = 0;
+uint64_t points_seen = 0;
+
+//switching starts the new window from scratch. the rectangular window's points are stale, and the exponential window's sums describe a different stretch of time
+void set_window(window_shape shape) {
+	window = shape;
+	index_begin = index_end;
+	sum_w = sum_t = sum_s = sum_tt = sum_ts = sum_ss = 0;
+	weighted_elements = 0;
+	residual_scale = 0;
+	exponential.reset();
+}
+
+uint window_points() { return window == rectangular_window ? elements() : uint(std::min<uint64_t>(exponential.points, ~0u)); }
+
+void publish() {
+	latest.elements = window_points();
+	latest.window_size = window == rectangular_window ? max_size : 0;
+	latest.generation = ++estimates_published;
+	if (replaying)
+		return;
+	phase = latest.phase;
+	period = latest.period;
+	drift = latest.drift;
 }
 
 void print_error(double accurate_ticks_per_scanline) {
-	//shortcut formula.
-	//https://www.cs.wustl.edu/~jain/iucee/ftp/k_14slr.pdf
-	//https://www.colorado.edu/amath/sites/default/files/attached-files/ch12_0.pdf
-	//our yiyi has zero as the origin point. that is very bad for rounding.
-	//thus, we transform our origin to the midpoint. we use these transformations: E[(xi - x)^2] = E[xi^2 - x^2]. E[(xi - x)(yi - y)] = E[xiyi - xy]
-	double yiyi = (elements() * sum_timepoint_timepoint - sum_of_timepoints * sum_of_timepoints) / elements();
-	double a_yi = 0; //free, because our average y_i is zero. (we chose this as the origin)
-	double bxiyi = accurate_ticks_per_scanline * (elements() * sum_timepoint_scanline - sum_of_timepoints * sum_of_unwrapped_scanlines) / elements();
-	uint64_t SSE = yiyi - a_yi - bxiyi;
-	auto error = std::sqrt(SSE / (elements() - 2));
-	outc("vsync finder std dev:", error);
+	outc("vsync finder std dev:", standard_error(accurate_ticks_per_scanline));
 }
 
 void new_value(uint64_t new_timepoint, uint scanline) {
+	//see unwrap_period
+	double unwrapping_period = unwrap_period > 0 ? unwrap_period : ticks_per_sec / system_claimed_monitor_Hz;
+	double frame_advance_from_previous = (new_timepoint - previous_timepoint) / unwrapping_period; //benchmark off the previous. we might also consider benchmarking off index_begin, in the future. not sure.
+	int scanline_diff_from_previous = scanline - previous_scanline;
+	double exact_frames = frame_advance_from_previous - scanline_diff_from_previous / double(total_scanlines);
+	double advanced_frames = std::nearbyint(exact_frames);
+	if (window_points() != 0) {
+		double uncertainty = unwrap_period > 0 ? unwrap_sigmas * (frame_advance_from_previous * unwrap_period_error + latest.error) / unwrap_period : frame_advance_from_previous * claimed_rate_error;
+		if (std::abs(exact_frames - advanced_frames) + uncertainty >= 0.5) {
+			if (!replaying)
+				push_vsync_event({new_timepoint, event_scanline_quarantined, source_vscan, latest.elements, latest.period, latest.error});
+			if (++quarantined_in_a_row < quarantine_limit)
+				return;
+			if (!replaying)
+				push_vsync_event({new_timepoint, event_restart, source_vscan, latest.elements, latest.period, latest.error});
+			set_window(window);
+		}
+	}
+	quarantined_in_a_row = 0;
+	uint frame = previous_frame + int(advanced_frames);
+	if (advanced_frames >= 2 && points_seen >= 1 && !replaying)
+		push_vsync_event({new_timepoint, event_scanline_skip, source_vscan, latest.elements, latest.period, 0});
+	previous_timepoint = new_timepoint;
+	previous_scanline = scanline;
+	previous_frame = frame;
+	++points_seen;
+
+	if (window == exponential_window) {
+		bool judge = robust && exponential.points >= robust_after;
+		exponential.add(new_timepoint, frame, scanline, judge ? huber_weight(exponential.residual(new_timepoint, frame, scanline)) : weight_one);
+		if (exponential.points <= 2) {
+			latest.phase = new_timepoint - int64_t(ticks_per_sec * scanline / (total_scanlines * system_claimed_monitor_Hz));
+			latest.period = ticks_per_sec / system_claimed_monitor_Hz;
+		}
+		else
+			exponential.regression();
+		publish();
+		return;
+	}
+
 	if (elements() == max_size) {
-		sum_of_timepoints -= timepoint_at(index_begin);
-		uint64_t unwrapped_scanline = frame_at(index_begin) * total_scanlines + scanline_at(index_begin);
-		sum_of_unwrapped_scanlines -= unwrapped_scanline;
-		sum_timepoint_timepoint -= timepoint_at(index_begin) * timepoint_at(index_begin);
-		sum_timepoint_scanline -= timepoint_at(index_begin) * unwrapped_scanline;
-		sum_scanline_scanline -= unwrapped_scanline * unwrapped_scanline;
+		add_to_sums(index_begin, -1);
 		++index_begin;
+		move_origin(index_begin);
 	}
 	timepoint_at(index_end) = new_timepoint;
 	scanline_at(index_end) = scanline;
-	double frame_advance_from_previous = (new_timepoint - timepoint_at(index_end - 1)) * system_claimed_monitor_Hz / ticks_per_sec; //benchmark off the previous. we might also consider benchmarking off index_begin, in the future. not sure.
-	int scanline_diff_from_previous = scanline - scanline_at(index_end - 1);
-	double advanced_frames = std::nearbyint(frame_advance_from_previous - scanline_diff_from_previous / double(total_scanlines));
-	frame_at(index_end) = frame_at(index_end - 1) + int(advanced_frames);
-	sum_of_timepoints += timepoint_at(index_end);
-	uint64_t unwrapped_scanline = frame_at(index_end) * total_scanlines + scanline_at(index_end);
-	sum_of_unwrapped_scanlines += unwrapped_scanline;
-	sum_timepoint_timepoint += timepoint_at(index_end) * timepoint_at(index_end);
-	sum_timepoint_scanline += timepoint_at(index_end) * unwrapped_scanline;
-	sum_scanline_scanline += unwrapped_scanline * unwrapped_scanline;
+	frame_at(index_end) = frame;
+	if (elements() == 0) {
+		origin_timepoint = timepoint_at(index_end);
+		origin_frame = frame_at(index_end);
+	}
+	bool judge = robust && elements() >= robust_after && weighted_elements >= 3;
+	weight_at(index_end) = judge ? huber_weight(t_at(index_end) - to_double(sum_t) / to_double(sum_w) - ticks_per_scanline * (s_at(index_end) - to_double(sum_s) / to_double(sum_w))) : weight_one;
+	add_to_sums(index_end, 1);
 	++index_end;
 	if (elements() <= 2) { //don't need to care too much, whether it's 1 or 2 points.
-		phase = timepoint_at(index_end - 1) - int64_t(ticks_per_sec * scanline_at(index_end - 1) / (total_scanlines * system_claimed_monitor_Hz));
-		period = ticks_per_sec / system_claimed_monitor_Hz;
-		return;
+		latest.phase = timepoint_at(index_end - 1) - int64_t(ticks_per_sec * scanline_at(index_end - 1) / (total_scanlines * system_claimed_monitor_Hz));
+		latest.period = ticks_per_sec / system_claimed_monitor_Hz;
 	}
+	else
+		linear_regression();
+	publish();
+}
 
-	linear_regression();
+//replays a recorded trace of (timepoint, scanline) pairs in one call, like replay_timepoints() in vsync.cpp: phase and period are only published at the end.
+//trajectory receives the estimate after each pair. it can be empty. if vscan was already replaying, it stays that way, and nothing is published.
+void new_values(std::span<const uint64_t> timepoints, std::span<const uint> scanlines, std::span<vblank_estimate> trajectory = {}) {
+	check(scanlines.size() == timepoints.size(), "every timepoint needs a scanline", timepoints.size(), scanlines.size());
+	check(trajectory.empty() || trajectory.size() >= timepoints.size(), "trajectory is too short", trajectory.size(), timepoints.size());
+	bool was_replaying = replaying;
+	replaying = true;
+	for (size_t x = 0; x < timepoints.size(); ++x) {
+		new_value(timepoints[x], scanlines[x]);
+		if (!trajectory.empty())
+			trajectory[x] = latest;
+	}
+	replaying = was_replaying;
+	if (was_replaying)
+		return;
+	phase = latest.phase;
+	period = latest.period;
+	drift = latest.drift;
 }
 } // namespace vscan
\ No newline at end of file